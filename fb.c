@@ -8,20 +8,184 @@
 #include <unistd.h>
 #include <linux/fb.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fb_pixel.h"
 
 #define INTENTIONALLY_UNUSED_PARAMETER( param) (void)(param)
 
+/* Test pattern for a framebuffer :  shows a 255x200 gradient (red,
+with blue increasing to the right and green downward),  or a grey ramp
+in 8-bit palette mode,  then waits for Enter.  Any format fb_pixel.c
+handles (8,  16,  24 or 32 bits/pixel) can be shown.
+
+   Run as './fb -a (n)' to instead show 'n' frames (default 600) of a
+full-screen animation,  double-buffered :  see animate() below. */
+
+   /* Returns 0 if we waited for vertical blank,  -1 if the driver
+   can't do that (or the kernel headers don't know about it). */
+
+static int wait_for_vsync( const int fb_fd)
+{
+#ifdef FBIO_WAITFORVSYNC
+   uint32_t crtc = 0;
+
+   return( ioctl( fb_fd, FBIO_WAITFORVSYNC, &crtc));
+#else
+   INTENTIONALLY_UNUSED_PARAMETER( fb_fd);
+   return( -1);
+#endif
+}
+
+   /* A box bouncing around a background that shifts colour every
+   frame,  so that every pixel changes and any tearing is obvious. */
+
+static void draw_frame( const struct fb_pixel_format *fmt, uint8_t *dest,
+            const size_t stride, const uint32_t xres, const uint32_t yres,
+            const uint32_t frame)
+{
+   const uint32_t box = yres / 4, x_range = xres - box, y_range = yres - box;
+   uint32_t x = (frame * 13) % (2 * x_range), y = (frame * 7) % (2 * y_range);
+   const int shade = (int)( frame % 64);
+
+   if( x >= x_range)
+      x = 2 * x_range - x;
+   if( y >= y_range)
+      y = 2 * y_range - y;
+   fb_fill_rect( fmt, dest, stride, xres, yres,
+                  fb_rgb_pixel( fmt, 0, shade, 64 + shade));
+   fb_fill_rect( fmt, dest + y * stride + x * fmt->bytes_per_pixel, stride,
+                  box, box, fb_rgb_pixel( fmt, 0xff, 0xff, 0xff));
+}
+
+   /* Frames are never drawn on the visible screen.  If the virtual
+framebuffer is at least twice the screen height (we ask the driver to
+make it so,  if it isn't),  each frame is drawn in the hidden half,
+and shown with FBIOPAN_DISPLAY,  after waiting for vertical blank if the
+driver supports FBIO_WAITFORVSYNC.  That's tear-free.  If panning isn't
+possible,  frames are drawn in ordinary memory and copied to the screen
+with one memcpy() just after vertical blank;  that may tear a little on
+big screens,  but far less than drawing in place.  The original video
+mode is restored afterward. */
+
+   /* Runs the animation once the virtual resolution has been set up.
+   Everything after the mmap() that can fail leaves through the one
+   exit at the bottom,  which frees the back buffer and unmaps. */
+
+static int _run_animation( const int fb_fd, const struct fb_pixel_format *fmt,
+                    const int n_frames)
+{
+   struct fb_var_screeninfo vinfo;
+   struct fb_fix_screeninfo finfo;
+   uint8_t *screen, *visible, *back = NULL;
+   size_t page_bytes;
+   int flipping, vsync = 1, page = 0, i, rval = -1;
+   struct timespec t0, t1;
+   double elapsed;
+
+   if( ioctl( fb_fd, FBIOGET_VSCREENINFO, &vinfo)
+               || ioctl( fb_fd, FBIOGET_FSCREENINFO, &finfo))
+      return( -1);
+   page_bytes = (size_t)finfo.line_length * vinfo.yres;
+   flipping = (vinfo.yres_virtual >= vinfo.yres * 2 && finfo.ypanstep
+               && finfo.smem_len >= 2 * page_bytes);
+   screen = mmap( NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
+   if( screen == MAP_FAILED)
+      return( -1);
+   if( flipping)
+      {
+      vinfo.xoffset = vinfo.yoffset = 0;
+      if( ioctl( fb_fd, FBIOPAN_DISPLAY, &vinfo))
+         flipping = 0;
+      }
+   if( !flipping)
+      back = (uint8_t *)malloc( page_bytes);
+   if( !ioctl( fb_fd, FBIOGET_VSCREENINFO, &vinfo) && (flipping || back))
+      {
+      visible = screen + (size_t)vinfo.yoffset * finfo.line_length;
+      clock_gettime( CLOCK_MONOTONIC, &t0);
+      for( i = 0; i < n_frames; i++)
+         {
+         uint8_t *dest = (flipping ? screen + (page ^ 1) * page_bytes : back);
+
+         draw_frame( fmt, dest, finfo.line_length, vinfo.xres, vinfo.yres, (uint32_t)i);
+         if( vsync && wait_for_vsync( fb_fd))
+            vsync = 0;
+         if( flipping)
+            {
+            vinfo.yoffset = (page ^ 1) * vinfo.yres;
+            if( !ioctl( fb_fd, FBIOPAN_DISPLAY, &vinfo))
+               {
+               page ^= 1;
+               visible = dest;
+               }
+            else        /* driver refused after all;  copy from now on */
+               {
+               vinfo.yoffset = page * vinfo.yres;
+               flipping = 0;
+               back = (uint8_t *)malloc( page_bytes);
+               if( !back)
+                  break;
+               memcpy( visible, dest, page_bytes);
+               }
+            }
+         else
+            memcpy( visible, back, page_bytes);
+         }
+      clock_gettime( CLOCK_MONOTONIC, &t1);
+      if( i == n_frames)
+         {
+         elapsed = (double)( t1.tv_sec - t0.tv_sec)
+                        + (double)( t1.tv_nsec - t0.tv_nsec) * 1e-9;
+         printf( "%d frames in %.3f s (%.1f frames/s);  %s,  %s\n", n_frames, elapsed,
+                  (elapsed > 0. ? (double)n_frames / elapsed : 0.),
+                  (flipping ? "page flipping" : "copying to screen"),
+                  (vsync ? "synced to vertical blank" : "no vsync"));
+         rval = 0;
+         }
+      }
+   free( back);
+   munmap( screen, finfo.smem_len);
+   return( rval);
+}
+
+   /* Asks for a virtual framebuffer twice the screen height,  runs the
+   animation,  and puts the original mode back however that went. */
+
+static int animate( const int fb_fd, const struct fb_pixel_format *fmt,
+                    const int n_frames)
+{
+   struct fb_var_screeninfo vinfo, orig;
+   int rval;
+
+   if( ioctl( fb_fd, FBIOGET_VSCREENINFO, &vinfo))
+      return( -1);
+   orig = vinfo;
+   if( vinfo.yres_virtual < vinfo.yres * 2)
+      {
+      vinfo.yres_virtual = vinfo.yres * 2;
+      ioctl( fb_fd, FBIOPUT_VSCREENINFO, &vinfo);
+      }
+   rval = _run_animation( fb_fd, fmt, n_frames);
+   ioctl( fb_fd, FBIOPUT_VSCREENINFO, &orig);
+   return( rval);
+}
+
 int main( const int argc, const char **argv)
 {
    int fb_fd = open( "/dev/fb0", O_RDWR);
    int i, j;
    struct fb_fix_screeninfo finfo;
    struct fb_var_screeninfo vinfo;
+   struct fb_pixel_format fmt;
    int err;
    uint8_t *buff;
+   uint32_t *image;
+   int n_frames = 0;
 
-   INTENTIONALLY_UNUSED_PARAMETER( argc);
-   INTENTIONALLY_UNUSED_PARAMETER( argv);
+   if( argc > 1 && !strcmp( argv[1], "-a"))
+      n_frames = (argc > 2 ? atoi( argv[2]) : 600);
    if( fb_fd <= 0)
       perror( "fb_fd <= 0");
    assert( fb_fd > 0);
@@ -34,6 +198,16 @@ int main( const int argc, const char **argv)
                     (unsigned)vinfo.xres_virtual, (unsigned)vinfo.yres_virtual);
    printf( "%u bits/pixel\n", (unsigned)vinfo.bits_per_pixel);
    printf( "Grayscale: %u\n", (unsigned)vinfo.grayscale);
+   printf( "RGB lengths %u/%u/%u,  offsets %u/%u/%u\n",
+            (unsigned)vinfo.red.length, (unsigned)vinfo.green.length,
+            (unsigned)vinfo.blue.length, (unsigned)vinfo.red.offset,
+            (unsigned)vinfo.green.offset, (unsigned)vinfo.blue.offset);
+   if( get_fb_pixel_format( &fmt, &vinfo))
+      {
+      printf( "At least at present,  this program doesn't support this pixel format.\n");
+      close( fb_fd);
+      return( -1);
+      }
 
    /*  Get fixed screen information */
    err = ioctl(fb_fd, FBIOGET_FSCREENINFO, &finfo);
@@ -42,9 +216,6 @@ int main( const int argc, const char **argv)
    printf( "%u bytes/line\n", (unsigned)finfo.line_length);
    printf( "%u bytes memory needed\n", (unsigned)finfo.smem_len);
 
-   buff = mmap( NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
-   assert( buff != MAP_FAILED);
-
    if ( vinfo.bits_per_pixel == 8)        /* 256 color palette */
       {                              /* leave first 16 colors at default; */
       uint16_t r[256], g[256], b[256];   /* set others to gray scales */
@@ -62,25 +233,27 @@ int main( const int argc, const char **argv)
          printf( "Error setting palette.\n");
       }
 
-   for( i = 300; i < 500; i++)
-      if( vinfo.bits_per_pixel == 32)        /* full 32-bit color */
-         {
-         uint32_t *tptr = (uint32_t *)( buff + i * finfo.line_length);
+   if( n_frames > 0)
+      {
+      err = animate( fb_fd, &fmt, n_frames);
+      close( fb_fd);
+      return( err);
+      }
 
-         for( j = 0; j < 255; j++)
-            tptr[j + 200] = 0xff0000 + j + ((i - 300) << 8);
-         }
-      else if( vinfo.bits_per_pixel == 8)        /* 256 color palette */
-         {
-         uint8_t *tptr = buff + i * finfo.line_length;
+   buff = mmap( NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
+   assert( buff != MAP_FAILED);
 
-         for( j = 0; j < 255; j++)
-            tptr[j + 200] = (uint8_t)j;
-         }
+   image = (uint32_t *)malloc( 255 * 200 * sizeof( uint32_t));
+   assert( image);
+   for( i = 0; i < 200; i++)
+      for( j = 0; j < 255; j++)
+         image[i * 255 + j] = (fmt.is_palette ? (uint32_t)j * 0x010101
+                                 : 0xff0000 + (uint32_t)( j + (i << 8)));
+   fb_blit_rgb( &fmt, buff + 300 * finfo.line_length + 200 * fmt.bytes_per_pixel,
+                  finfo.line_length, image, 255, 255, 200);
+   free( image);
    getchar( );
    munmap( buff, finfo.smem_len);
    close( fb_fd);
-   if( vinfo.bits_per_pixel != 8 && vinfo.bits_per_pixel != 32)
-      printf( "At least at present,  this program doesn't support this bit depth.\n");
    return( 0);
 }
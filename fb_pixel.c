@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <string.h>
+#include <linux/fb.h>
+#include "fb_pixel.h"
+
+#define INTENTIONALLY_UNUSED_PARAMETER( param) (void)(param)
+
+/* Framebuffers come in 8-bit (palette),  16-bit (usually RGB565),
+packed 24-bit and 32-bit flavours,  with the red,  green and blue bits
+wherever the driver cares to put them.  get_fb_pixel_format() reads
+all that from fb_var_screeninfo,  and fb_rgb_pixel() then packs a
+colour into a pixel value for that format.
+
+   The drawing functions (fill a rectangle,  copy in an image,  draw a
+glyph) are each written once,  as a macro,  and expanded for 1,  2,  3
+and 4 bytes per pixel.  Which expansion to use is decided once per
+call;  the inner loops store each pixel with a fixed-size write,  and
+contain no tests of the pixel format (nor,  for glyphs,  of the bit
+being drawn :  a mask picks foreground or background).
+
+   Pixel values are stored in the machine's byte order;  for 24-bit,
+the low byte comes first,  which is what fbdev drivers expect on the
+little-endian machines that have them.  */
+
+static void _store_1( uint8_t *dest, const uint32_t pixel)
+{
+   *dest = (uint8_t)pixel;
+}
+
+static void _store_2( uint8_t *dest, const uint32_t pixel)
+{
+   const uint16_t pixel16 = (uint16_t)pixel;
+
+   memcpy( dest, &pixel16, 2);
+}
+
+static void _store_3( uint8_t *dest, const uint32_t pixel)
+{
+   dest[0] = (uint8_t)pixel;
+   dest[1] = (uint8_t)( pixel >> 8);
+   dest[2] = (uint8_t)( pixel >> 16);
+}
+
+static void _store_4( uint8_t *dest, const uint32_t pixel)
+{
+   memcpy( dest, &pixel, 4);
+}
+
+int get_fb_pixel_format( struct fb_pixel_format *fmt,
+                                 const struct fb_var_screeninfo *vinfo)
+{
+   memset( fmt, 0, sizeof( struct fb_pixel_format));
+   fmt->bytes_per_pixel = (int)( vinfo->bits_per_pixel / 8);
+   if( vinfo->bits_per_pixel % 8 || fmt->bytes_per_pixel < 1
+                                 || fmt->bytes_per_pixel > 4)
+      return( -1);
+   if( fmt->bytes_per_pixel == 1)
+      {
+      fmt->is_palette = 1;
+      return( 0);
+      }
+   if( !vinfo->red.length || !vinfo->green.length || !vinfo->blue.length
+            || vinfo->red.offset + vinfo->red.length > vinfo->bits_per_pixel
+            || vinfo->green.offset + vinfo->green.length > vinfo->bits_per_pixel
+            || vinfo->blue.offset + vinfo->blue.length > vinfo->bits_per_pixel)
+      return( -2);
+   fmt->red_offset = (uint8_t)vinfo->red.offset;
+   fmt->red_length = (uint8_t)vinfo->red.length;
+   fmt->green_offset = (uint8_t)vinfo->green.offset;
+   fmt->green_length = (uint8_t)vinfo->green.length;
+   fmt->blue_offset = (uint8_t)vinfo->blue.offset;
+   fmt->blue_length = (uint8_t)vinfo->blue.length;
+   if( vinfo->transp.length && vinfo->transp.length < 32
+            && vinfo->transp.offset + vinfo->transp.length <= vinfo->bits_per_pixel)
+      fmt->opaque = (((uint32_t)1 << vinfo->transp.length) - 1) << vinfo->transp.offset;
+   return( 0);
+}
+
+   /* Scales an 8-bit channel value to 'length' bits (which can be more
+   or less than eight),  and puts it at 'offset'. */
+
+#define PACK_CHANNEL( value, offset, length) \
+         (((((uint32_t)(value) & 0xff) << 24) >> (32 - (length))) << (offset))
+
+   /* For palette formats,  there's no general mapping from RGB;  the
+   luminance (0-255) is returned,  which suits a grey-scale palette
+   such as fb.c sets up.  */
+
+uint32_t fb_rgb_pixel( const struct fb_pixel_format *fmt,
+                                 const int red, const int green, const int blue)
+{
+   if( fmt->is_palette)
+      return( (uint32_t)( red * 77 + green * 150 + blue * 29) >> 8);
+   return( PACK_CHANNEL( red, fmt->red_offset, fmt->red_length)
+         | PACK_CHANNEL( green, fmt->green_offset, fmt->green_length)
+         | PACK_CHANNEL( blue, fmt->blue_offset, fmt->blue_length)
+         | fmt->opaque);
+}
+
+#define FILL_KERNEL( BPP)                                                  \
+static void _fill_##BPP( uint8_t *dest, const size_t stride,               \
+            const uint32_t width, const uint32_t height, const uint32_t pixel) \
+{                                                                          \
+   uint32_t x, y;                                                          \
+                                                                           \
+   for( y = 0; y < height; y++, dest += stride)                            \
+      for( x = 0; x < width; x++)                                          \
+         _store_##BPP( dest + x * BPP, pixel);                             \
+}
+
+   /* Source pixels are 0xRRGGBB. */
+
+#define BLIT_KERNEL( BPP)                                                  \
+static void _blit_##BPP( const struct fb_pixel_format *fmt, uint8_t *dest, \
+            const size_t stride, const uint32_t *src, const size_t src_stride, \
+            const uint32_t width, const uint32_t height)                   \
+{                                                                          \
+   const int r_off = fmt->red_offset, r_len = fmt->red_length;             \
+   const int g_off = fmt->green_offset, g_len = fmt->green_length;         \
+   const int b_off = fmt->blue_offset, b_len = fmt->blue_length;           \
+   uint32_t x, y;                                                          \
+                                                                           \
+   for( y = 0; y < height; y++, dest += stride, src += src_stride)         \
+      for( x = 0; x < width; x++)                                          \
+         _store_##BPP( dest + x * BPP,                                     \
+                     PACK_CHANNEL( src[x] >> 16, r_off, r_len)             \
+                   | PACK_CHANNEL( src[x] >> 8, g_off, g_len)              \
+                   | PACK_CHANNEL( src[x], b_off, b_len) | fmt->opaque);   \
+}
+
+   /* 'bits' holds the glyph as in a PSF font :  one bit per pixel,  each
+   row padded to a whole byte,  most significant bit leftmost. */
+
+#define GLYPH_KERNEL( BPP)                                                 \
+static void _glyph_##BPP( uint8_t *dest, const size_t stride,              \
+            const uint8_t *bits, const uint32_t width, const uint32_t height, \
+            const uint32_t fg, const uint32_t bg)                          \
+{                                                                          \
+   const uint32_t bytes_per_row = (width + 7) / 8, diff = fg ^ bg;         \
+   uint32_t x, y;                                                          \
+                                                                           \
+   for( y = 0; y < height; y++, dest += stride, bits += bytes_per_row)     \
+      for( x = 0; x < width; x++)                                          \
+         {                                                                 \
+         const uint32_t mask = 0 - (uint32_t)( (bits[x >> 3] >> (7 - (x & 7))) & 1); \
+                                                                           \
+         _store_##BPP( dest + x * BPP, bg ^ (diff & mask));                \
+         }                                                                 \
+}
+
+FILL_KERNEL( 1)
+FILL_KERNEL( 2)
+FILL_KERNEL( 3)
+FILL_KERNEL( 4)
+BLIT_KERNEL( 2)
+BLIT_KERNEL( 3)
+BLIT_KERNEL( 4)
+GLYPH_KERNEL( 1)
+GLYPH_KERNEL( 2)
+GLYPH_KERNEL( 3)
+GLYPH_KERNEL( 4)
+
+   /* Palette 'blit' stores the luminance,  as fb_rgb_pixel() does. */
+
+static void _blit_1( const struct fb_pixel_format *fmt, uint8_t *dest,
+            const size_t stride, const uint32_t *src, const size_t src_stride,
+            const uint32_t width, const uint32_t height)
+{
+   uint32_t x, y;
+
+   INTENTIONALLY_UNUSED_PARAMETER( fmt);
+   for( y = 0; y < height; y++, dest += stride, src += src_stride)
+      for( x = 0; x < width; x++)
+         dest[x] = (uint8_t)( (((src[x] >> 16) & 0xff) * 77
+                  + ((src[x] >> 8) & 0xff) * 150 + (src[x] & 0xff) * 29) >> 8);
+}
+
+void fb_fill_rect( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint32_t width, const uint32_t height,
+               const uint32_t pixel)
+{
+   switch( fmt->bytes_per_pixel)
+      {
+      case 1:
+         _fill_1( dest, stride, width, height, pixel);
+         break;
+      case 2:
+         _fill_2( dest, stride, width, height, pixel);
+         break;
+      case 3:
+         _fill_3( dest, stride, width, height, pixel);
+         break;
+      case 4:
+         _fill_4( dest, stride, width, height, pixel);
+         break;
+      }
+}
+
+   /* Copies a 'width' by 'height' image of 0xRRGGBB pixels,  whose rows
+   are 'src_stride' pixels apart,  converting to the framebuffer format. */
+
+void fb_blit_rgb( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint32_t *src, const size_t src_stride,
+               const uint32_t width, const uint32_t height)
+{
+   switch( fmt->bytes_per_pixel)
+      {
+      case 1:
+         _blit_1( fmt, dest, stride, src, src_stride, width, height);
+         break;
+      case 2:
+         _blit_2( fmt, dest, stride, src, src_stride, width, height);
+         break;
+      case 3:
+         _blit_3( fmt, dest, stride, src, src_stride, width, height);
+         break;
+      case 4:
+         _blit_4( fmt, dest, stride, src, src_stride, width, height);
+         break;
+      }
+}
+
+void fb_draw_glyph( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint8_t *bits,
+               const uint32_t width, const uint32_t height,
+               const uint32_t fg, const uint32_t bg)
+{
+   switch( fmt->bytes_per_pixel)
+      {
+      case 1:
+         _glyph_1( dest, stride, bits, width, height, fg, bg);
+         break;
+      case 2:
+         _glyph_2( dest, stride, bits, width, height, fg, bg);
+         break;
+      case 3:
+         _glyph_3( dest, stride, bits, width, height, fg, bg);
+         break;
+      case 4:
+         _glyph_4( dest, stride, bits, width, height, fg, bg);
+         break;
+      }
+}
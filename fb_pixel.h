@@ -0,0 +1,26 @@
+/* Pixel formats and drawing kernels for framebuffers;  see fb_pixel.c.
+<linux/fb.h> must be included first. */
+
+struct fb_pixel_format {
+   int bytes_per_pixel;       /* 1, 2, 3 or 4 */
+   int is_palette;            /* 8-bit;  pixel values are palette indices */
+   uint8_t red_offset, red_length;
+   uint8_t green_offset, green_length;
+   uint8_t blue_offset, blue_length;
+   uint32_t opaque;           /* alpha bits,  if any,  all set */
+};
+
+int get_fb_pixel_format( struct fb_pixel_format *fmt,
+                                 const struct fb_var_screeninfo *vinfo);
+uint32_t fb_rgb_pixel( const struct fb_pixel_format *fmt,
+                                 const int red, const int green, const int blue);
+void fb_fill_rect( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint32_t width, const uint32_t height,
+               const uint32_t pixel);
+void fb_blit_rgb( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint32_t *src, const size_t src_stride,
+               const uint32_t width, const uint32_t height);
+void fb_draw_glyph( const struct fb_pixel_format *fmt, uint8_t *dest,
+               const size_t stride, const uint8_t *bits,
+               const uint32_t width, const uint32_t height,
+               const uint32_t fg, const uint32_t bg);
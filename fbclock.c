@@ -26,75 +26,217 @@ http://raspberrycompote.blogspot.com/2013/03/low-level-graphics-on-raspberry-pi-
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <linux/fb.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <sysexits.h>
 #include <time.h>
 #include <unistd.h>
-#include <zlib.h>
-
-static const uint32_t PSF2Magic = 0x864AB572;
-struct PSF2Header {
-   uint32_t magic;
-   uint32_t version;
-   uint32_t headerSize;
-   uint32_t flags;
-   uint32_t glyphCount;
-   uint32_t glyphSize;
-   uint32_t glyphHeight;
-   uint32_t glyphWidth;
-};
+#include "psf.h"
+#include "psf_gz.h"
+#include "fb_pixel.h"
+
+/* The font is read with psf.c,  via psf_gz.c,  so it can be PSF1,
+PSF2 or vgafont,  gzipped or not.  The clock only needs digits and ':',
+so only the first FONT_GLYPHS glyphs of a gzipped font are decompressed;
+that means no Unicode table,  and such fonts must have ASCII in glyphs
+0-127 (console fonts almost always do).  Uncompressed fonts are just
+memory-mapped,  and characters are found through the Unicode table (if
+there is one),  so they needn't have ASCII there.
+Drawing goes through fb_pixel.c,  so any of 8,  16,  24 or 32 bits per
+pixel will do. */
+
+#define NS_PER_SEC ((int64_t)1000000000)
+#define FONT_GLYPHS 128
+
+/* Rather than write each pixel straight to the framebuffer,  the clock
+is drawn into an off-screen copy of its area of the screen.  That's
+compared,  one character cell at a time,  row by row,  against what was
+drawn last time,  and only rows that changed are copied to the screen.
+Usually that's just the last digit or two of the seconds,  so the
+panel's memory bandwidth isn't wasted,  and nothing is ever drawn
+directly on the visible screen a pixel at a time (which could tear).
+Set FBCLOCK_VERBOSE to see how many bytes were written each tick.
+
+   Redraws are driven by a timerfd on CLOCK_REALTIME,  set to go off
+exactly on the boundaries of the update period (default one second),
+so the display doesn't drift against the wall clock or skip seconds,
+and the CPU idles in between.  Set FBCLOCK_PERIOD to change the period :
+0.5 for twice a second,  60 to update (and show) only hours and
+minutes,  and so on (see get_period()).  The timer is set with TFD_TIMER_CANCEL_ON_SET,
+so if the clock is set (or jumps),  we find out,  redraw and re-align.
+If timerfd isn't available,  clock_nanosleep() to each boundary does
+nearly as well. */
+
+static void draw_clock( uint8_t *frame, const size_t frame_stride,
+         const struct fb_pixel_format *fmt, const struct font_info *font,
+         const char *str, const uint32_t fg, const uint32_t bg)
+{
+   const uint32_t width = font->width * (uint32_t)strlen( str) + 1;
+   uint8_t *tptr = frame + fmt->bytes_per_pixel;
+   const char *s;
+
+   fb_fill_rect( fmt, frame, frame_stride, 1, font->height, fg);  /* left border */
+   fb_fill_rect( fmt, frame + font->height * frame_stride, frame_stride,
+                  width, 1, fg);                               /* bottom border */
+   for( s = str; *s; ++s) {
+      const int glyph_num = find_psf_or_vgafont_glyph( font, (unsigned char)*s);
+      const uint8_t *glyph = font->glyphs;     /* glyph 0 if it's missing */
+
+      if( glyph_num > 0)
+         glyph += (size_t)glyph_num * font->charsize;
+      fb_draw_glyph( fmt, tptr, frame_stride, glyph, font->width, font->height,
+                  fg, bg);
+      tptr += font->width * fmt->bytes_per_pixel;
+   }
+}
+
+   /* Copies rows of each cell that differ from the last frame to the
+screen.  Cell 0 is the left border;  then there's one cell per character,
+and the last 'row' is the bottom border,  which is compared as a whole.
+Returns the number of bytes written to the framebuffer. */
+
+static size_t flush_changes( const uint8_t *frame, uint8_t *prev,
+         const size_t frame_stride, uint8_t *screen, const size_t screen_stride,
+         const int bytes_per_pixel, const struct font_info *font)
+{
+   const size_t cell_bytes = font->width * bytes_per_pixel;
+   const size_t n_cells = (frame_stride - bytes_per_pixel) / cell_bytes;
+   size_t rval = 0, cell, x_offset, n_bytes;
+   uint32_t y;
+
+   for( y = 0; y <= font->height; y++)
+      for( cell = 0; cell <= n_cells; cell++) {
+         const uint8_t *from;
+
+         if( y == font->height) {      /* bottom border:  whole row */
+            if( cell)
+               break;
+            x_offset = 0;
+            n_bytes = frame_stride;
+         }
+         else if( !cell) {
+            x_offset = 0;
+            n_bytes = bytes_per_pixel;
+         }
+         else {
+            x_offset = bytes_per_pixel + (cell - 1) * cell_bytes;
+            n_bytes = cell_bytes;
+         }
+         from = frame + y * frame_stride + x_offset;
+         if( memcmp( from, prev + y * frame_stride + x_offset, n_bytes)) {
+            memcpy( screen + y * screen_stride + x_offset, from, n_bytes);
+            memcpy( prev + y * frame_stride + x_offset, from, n_bytes);
+            rval += n_bytes;
+         }
+      }
+   return( rval);
+}
+
+static int64_t next_boundary( const int64_t period_ns)
+{
+   struct timespec now;
+
+   clock_gettime( CLOCK_REALTIME, &now);
+   return( ((int64_t)now.tv_sec * NS_PER_SEC + now.tv_nsec) / period_ns * period_ns
+                     + period_ns);
+}
+
+static int arm_timer( const int tfd, const int64_t period_ns)
+{
+   struct itimerspec spec;
+   const int64_t when = next_boundary( period_ns);
+
+   spec.it_value.tv_sec = (time_t)( when / NS_PER_SEC);
+   spec.it_value.tv_nsec = (long)( when % NS_PER_SEC);
+   spec.it_interval.tv_sec = (time_t)( period_ns / NS_PER_SEC);
+   spec.it_interval.tv_nsec = (long)( period_ns % NS_PER_SEC);
+   return( timerfd_settime( tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+                                 &spec, NULL));
+}
+
+   /* Returns when it's time to redraw.  If the timer was cancelled
+   because the clock was set,  it's re-armed for the new time,  and we
+   return at once so the display catches up. */
+
+static void wait_for_tick( int *tfd, const int64_t period_ns)
+{
+   if( *tfd >= 0) {
+      uint64_t n_expirations;
+
+      while( read( *tfd, &n_expirations, sizeof( n_expirations)) < 0) {
+         if( errno == ECANCELED) {
+            if( arm_timer( *tfd, period_ns))
+               err( EX_OSERR, "timerfd_settime");
+            return;
+         }
+         if( errno != EINTR)
+            err( EX_OSERR, "timerfd");
+      }
+   }
+   else {
+      const int64_t when = next_boundary( period_ns);
+      struct timespec ts;
+
+      ts.tv_sec = (time_t)( when / NS_PER_SEC);
+      ts.tv_nsec = (long)( when % NS_PER_SEC);
+      while( clock_nanosleep( CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR)
+         ;
+   }
+}
+
+   /* FBCLOCK_PERIOD is in seconds,  from 0.01 to a day.  Anything else
+   (including text that isn't a number at all) gets a warning,  and the
+   default of one second. */
+
+static int64_t get_period( const char *period_str)
+{
+   char *endptr;
+   double period;
+
+   if( !period_str)
+      return( NS_PER_SEC);
+   period = strtod( period_str, &endptr);
+   if( endptr == period_str || *endptr || !(period >= 0.01 && period <= 86400.)) {
+      warnx( "FBCLOCK_PERIOD '%s' isn't from 0.01 to 86400 seconds;  using 1",
+                     period_str);
+      return( NS_PER_SEC);
+   }
+   return( (int64_t)( period * (double)NS_PER_SEC));
+}
 
 int main() {
-   uint8_t *glyphs;
-   struct PSF2Header header;
-   size_t len;
-   uint8_t *buf;
+   struct font_info font;
+   uint8_t *buf, *frame, *prev;
    struct fb_fix_screeninfo finfo;
    struct fb_var_screeninfo vinfo;
-   gzFile font = NULL;
    const char *fontPath = getenv("FONT");
    const char *fbPath = getenv("FRAMEBUFFER");
-   int fb, error;
+   const int verbose = (getenv( "FBCLOCK_VERBOSE") != NULL);
+   const int64_t period_ns = get_period( getenv( "FBCLOCK_PERIOD"));
+   const char *format = (period_ns >= 60 * NS_PER_SEC ? "%H:%M" : "%H:%M:%S");
+   const size_t n_cells = (period_ns >= 60 * NS_PER_SEC ? 5 : 8);
+   struct fb_pixel_format fmt;
+   int fb, error = -1, bytes_per_pixel, tfd;
+   uint32_t fg, bg;
+   size_t frame_stride, frame_size;
+   uint32_t left;
 
    if( fontPath && *fontPath)
-      font = gzopen( fontPath, "r");
-   if( !font)
-      font = gzopen( "/usr/share/consolefonts/Lat2-TerminusBold20x10.psf.gz", "r");
-   if( !font)
-      font = gzopen( "/usr/share/kbd/consolefonts/Lat2-Terminus16.psfu.gz", "r");
-
-   if (!font) err(EX_NOINPUT, "Font not loaded");
-
-   len = gzread(font, &header, sizeof(header));
-   if (!len && gzeof(font)) errx(EX_DATAERR, "%s: missing header", fontPath);
-   if (!len) errx(EX_IOERR, "%s", gzerror(font, NULL));
-
-   if (header.magic != PSF2Magic) {
-      errx(
-         EX_DATAERR, "%s: invalid header magic %08X",
-         fontPath, header.magic
-      );
-   }
-   if (header.headerSize != sizeof(struct PSF2Header)) {
-      errx(
-         EX_DATAERR, "%s: weird header size %d",
-         fontPath, header.headerSize
-      );
-   }
+      error = open_psf_gz( &font, fontPath, FONT_GLYPHS);
+   if( error)
+      error = open_psf_gz( &font, "/usr/share/consolefonts/Lat2-TerminusBold20x10.psf.gz", FONT_GLYPHS);
+   if( error)
+      error = open_psf_gz( &font, "/usr/share/kbd/consolefonts/Lat2-Terminus16.psfu.gz", FONT_GLYPHS);
 
-   glyphs = (uint8_t *)malloc( 128 * header.glyphSize);
-   assert( glyphs);
-   len = gzread( font, glyphs, header.glyphSize * 128);
-   if (!len && gzeof(font)) errx(EX_DATAERR, "%s: missing glyphs", fontPath);
-   if (!len) errx(EX_IOERR, "%s", gzerror(font, NULL));
-
-   gzclose(font);
+   if (error) errx(EX_NOINPUT, "Font not loaded");
 
    if (!fbPath) fbPath = "/dev/fb0";
 
@@ -107,84 +249,53 @@ int main() {
    error = ioctl(fb, FBIOGET_FSCREENINFO, &finfo);
    if (error) err(EX_IOERR, "%s", fbPath);
 
+   if( get_fb_pixel_format( &fmt, &vinfo))
+      errx( EX_CONFIG, "%u bits/pixel isn't supported", (unsigned)vinfo.bits_per_pixel);
+   fg = (fmt.is_palette ? 7 : fb_rgb_pixel( &fmt, 0xff, 0xff, 0xff));
+   bg = fb_rgb_pixel( &fmt, 0, 0, 0);
+   if( vinfo.xres < font.width * n_cells + 1 || vinfo.yres < font.height + 1)
+      errx( EX_CONFIG, "Font is too big for the screen");
+
    buf = mmap(NULL, finfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, fb, 0);
    if (buf == MAP_FAILED) err(EX_IOERR, "%s", fbPath);
 
+         /* The off-screen frame covers the clock and its borders,  at
+         the top right of the screen.  'prev' starts out different from
+         anything we'll draw,  so the first frame is written in full. */
+   bytes_per_pixel = fmt.bytes_per_pixel;
+   frame_stride = (font.width * n_cells + 1) * bytes_per_pixel;
+   frame_size = frame_stride * (font.height + 1);
+   frame = (uint8_t *)calloc( frame_size, 2);
+   if( !frame) err( EX_OSERR, "calloc");
+   prev = frame + frame_size;
+   memset( prev, 0x5a, frame_size);
+   left = vinfo.xres - font.width * n_cells - 1;
+
+   tfd = timerfd_create( CLOCK_REALTIME, TFD_CLOEXEC);
+   if( tfd >= 0 && arm_timer( tfd, period_ns)) {
+      close( tfd);
+      tfd = -1;
+   }
+
    for (;;) {
-      const uint32_t DarkWhite = 0xffffff;
-      const uint32_t DarkBlack = 0x0;
-      uint32_t left, bottom = header.glyphHeight;
       time_t t = time(NULL);
       char str[64];
       const struct tm *local = localtime(&t);
+      size_t n_written;
 
       if (t < 0) err(EX_OSERR, "time");
       if (!local) err(EX_OSERR, "localtime");
 
-      len = strftime(str, sizeof(str), "%H:%M:%S", local);
-      assert(len);
-
-      left = vinfo.xres - header.glyphWidth * len;
-      if( vinfo.bits_per_pixel == 32) {
-         uint32_t *tptr = (uint32_t *)buf;
-         uint32_t x, y;
-         const int line_len = finfo.line_length / sizeof( uint32_t);
-         const char *s;
-
-         for( y = 0; y < bottom; ++y) {
-            tptr[y * line_len + left - 1] = DarkWhite;
-         }
-         for( x = left - 1; x < vinfo.xres; ++x) {
-            tptr[bottom * line_len + x] = DarkWhite;
-         }
-
-         for( s = str; *s; ++s) {
-            const uint8_t *glyph = glyphs + (unsigned)*s * header.glyphSize;
-            uint32_t stride = header.glyphSize / header.glyphHeight;
-
-            for( y = 0; y < header.glyphHeight; ++y) {
-               for( x = 0; x < header.glyphWidth; ++x) {
-                  uint8_t bits = glyph[y * stride + x / 8];
-                  uint8_t bit = bits >> (7 - x % 8) & 1;
-                  tptr[y * line_len + left + x] = bit
-                     ? DarkWhite
-                     : DarkBlack;
-               }
-            }
-            left += header.glyphWidth;
-         }
-      }
-
-      else if( vinfo.bits_per_pixel == 8) {
-         uint32_t x, y;
-         const char *s;
-
-         for( y = 0; y < bottom; ++y) {
-            buf[y * finfo.line_length + left - 1] = (uint8_t)7;
-         }
-         for( x = left - 1; x < vinfo.xres; ++x) {
-            buf[bottom * finfo.line_length + x] = (uint8_t)7;
-         }
-
-         for( s = str; *s; ++s) {
-            const uint8_t *glyph = glyphs + (unsigned)*s * header.glyphSize;
-            uint32_t stride = header.glyphSize / header.glyphHeight;
-            for( y = 0; y < header.glyphHeight; ++y) {
-               for( x = 0; x < header.glyphWidth; ++x) {
-                  uint8_t bits = glyph[y * stride + x / 8];
-                  uint8_t bit = bits >> (7 - x % 8) & 1;
-                  buf[y * finfo.line_length + left + x] = bit
-                     ? 7 : 0;
-               }
-            }
-            left += header.glyphWidth;
-         }
-      }
-      else {
-         fprintf( stderr, "%d bits/pixel isn't supported\n", vinfo.bits_per_pixel);
-         return( 0);
-      }
-      sleep( 1);
+      if( strftime(str, sizeof(str), format, local) != n_cells)
+         errx( EX_SOFTWARE, "Unexpected time format");
+      draw_clock( frame, frame_stride, &fmt, &font, str, fg, bg);
+      n_written = flush_changes( frame, prev, frame_stride,
+               buf + left * bytes_per_pixel, finfo.line_length,
+               bytes_per_pixel, &font);
+      if( verbose)
+         fprintf( stderr, "%s: %u bytes written\n", str, (unsigned)n_written);
+      wait_for_tick( &tfd, period_ns);
    }
-   free( glyphs);
+   free( frame);
+   close_psf_or_vgafont( &font);
 }
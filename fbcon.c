@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "psf.h"
+#include "psf_cache.h"
+#include "fbcon.h"
+
+/* A text console drawn on a framebuffer (or any memory laid out like
+one),  using a PSF or vgafont font.  The screen is a grid of cells,
+each holding a code point,  foreground and background colours (indices
+into a 16-entry palette of pixel values),  and attributes.  The glyph
+for each cell is found with find_psf_or_vgafont_glyph() when the cell
+is set,  falling back to U+FFFD and then to glyph 0.
+
+   Setting a cell to what it already holds does nothing;  otherwise,
+its bit in a per-row damage bitmap is set.  fbcon_flush() then redraws
+only the damaged cells.  Runs of adjacent damaged cells in a row are
+drawn together :  each scanline of the run is assembled in a buffer
+from glyphs already expanded to pixels (see psf_cache.c;  there's one
+cache per colour pair,  made as needed,  each of up to 'cache_bytes';
+so the total can be up to 256 times that),  then copied to the screen
+with one memcpy().  Framebuffer memory is often uncached or write-
+combined,  so long sequential writes matter much more than the copying
+within ordinary memory.  psf_bench measures full-screen redraws at
+1080p and 4K.  */
+
+struct fbcon_cell {
+   uint32_t code_point;
+   int32_t glyph;
+   uint8_t fg, bg, attr;
+};
+
+#define N_COLORS     16
+#define MAX_SPAN    256
+
+struct fbcon {
+   const struct font_info *font;
+   uint8_t *framebuffer;
+   size_t line_length, cache_bytes;
+   int bytes_per_pixel;
+   uint32_t palette[N_COLORS];
+   uint8_t pixels[N_COLORS][4];  /* palette,  encoded as the caches do */
+   uint32_t n_cols, n_rows, words_per_row, max_span;
+   struct fbcon_cell *cells;
+   uint32_t *damage;             /* one bit per cell */
+   uint8_t *row_damaged;
+   uint8_t *span;                /* one scanline being assembled */
+   struct glyph_cache *caches[N_COLORS * N_COLORS];
+};
+
+struct fbcon *create_fbcon( const struct font_info *f, uint8_t *framebuffer,
+               const uint32_t xres, const uint32_t yres, const size_t line_length,
+               const int bytes_per_pixel, const uint32_t *palette,
+               const size_t cache_bytes)
+{
+   struct fbcon *con;
+   int i;
+
+   if( bytes_per_pixel < 1 || bytes_per_pixel > 4)
+      return( NULL);
+   if( !f->width || !f->height || xres < f->width || yres < f->height)
+      return( NULL);
+   con = (struct fbcon *)calloc( 1, sizeof( struct fbcon));
+   if( !con)
+      return( NULL);
+   con->font = f;
+   con->framebuffer = framebuffer;
+   con->line_length = line_length;
+   con->bytes_per_pixel = bytes_per_pixel;
+   con->cache_bytes = cache_bytes;
+   memcpy( con->palette, palette, sizeof( con->palette));
+   for( i = 0; i < N_COLORS; i++)
+      encode_glyph_cache_pixel( con->pixels[i], palette[i], bytes_per_pixel);
+   con->n_cols = xres / f->width;
+   con->n_rows = yres / f->height;
+   con->words_per_row = (con->n_cols + 31) / 32;
+         /* Glyph pointers for a whole span are fetched before drawing it.
+         If a span had more cells than its cache has slots,  later glyphs
+         could evict earlier ones;  so spans are kept short enough that
+         that can't happen.   */
+   con->max_span = (uint32_t)( cache_bytes
+                  / ((size_t)f->width * f->height * bytes_per_pixel));
+   if( con->max_span > MAX_SPAN)
+      con->max_span = MAX_SPAN;
+   if( !con->max_span)
+      con->max_span = 1;
+   con->cells = (struct fbcon_cell *)malloc( con->n_cols * con->n_rows
+                                 * sizeof( struct fbcon_cell));
+   con->damage = (uint32_t *)calloc( con->words_per_row * con->n_rows,
+                                 sizeof( uint32_t));
+   con->row_damaged = (uint8_t *)calloc( con->n_rows, 1);
+   con->span = (uint8_t *)malloc( (size_t)xres * bytes_per_pixel);
+   if( !con->cells || !con->damage || !con->row_damaged || !con->span)
+      {
+      free_fbcon( con);
+      return( NULL);
+      }
+   fbcon_clear( con, 0);
+   return( con);
+}
+
+void free_fbcon( struct fbcon *con)
+{
+   if( con)
+      {
+      size_t i;
+
+      for( i = 0; i < N_COLORS * N_COLORS; i++)
+         free_glyph_cache( con->caches[i]);
+      free( con->cells);
+      free( con->damage);
+      free( con->row_damaged);
+      free( con->span);
+      free( con);
+      }
+}
+
+void get_fbcon_size( const struct fbcon *con, uint32_t *n_cols, uint32_t *n_rows)
+{
+   *n_cols = con->n_cols;
+   *n_rows = con->n_rows;
+}
+
+static void _damage_all( struct fbcon *con)
+{
+   memset( con->damage, 0xff, con->words_per_row * con->n_rows * sizeof( uint32_t));
+   memset( con->row_damaged, 1, con->n_rows);
+}
+
+   /* Points the console at a different framebuffer (such as the other
+   page,  when page flipping),  which will need to be redrawn in full. */
+
+void fbcon_set_framebuffer( struct fbcon *con, uint8_t *framebuffer)
+{
+   con->framebuffer = framebuffer;
+   _damage_all( con);
+}
+
+static int32_t _find_glyph( const struct font_info *f, const uint32_t code_point)
+{
+   int rval = find_psf_or_vgafont_glyph( f, code_point);
+
+   if( rval < 0)
+      rval = find_psf_or_vgafont_glyph( f, 0xfffd);
+   return( rval < 0 ? 0 : rval);
+}
+
+void fbcon_put( struct fbcon *con, const uint32_t col, const uint32_t row,
+               const uint32_t code_point, const int fg, const int bg, const int attr)
+{
+   struct fbcon_cell *cell;
+
+   if( col >= con->n_cols || row >= con->n_rows)
+      return;
+   cell = con->cells + row * con->n_cols + col;
+   if( cell->code_point != code_point || cell->fg != (fg & (N_COLORS - 1))
+               || cell->bg != (bg & (N_COLORS - 1)) || cell->attr != (uint8_t)attr)
+      {
+      if( cell->code_point != code_point)
+         cell->glyph = _find_glyph( con->font, code_point);
+      cell->code_point = code_point;
+      cell->fg = (uint8_t)( fg & (N_COLORS - 1));
+      cell->bg = (uint8_t)( bg & (N_COLORS - 1));
+      cell->attr = (uint8_t)attr;
+      con->damage[row * con->words_per_row + col / 32] |= (uint32_t)1 << (col & 31);
+      con->row_damaged[row] = 1;
+      }
+}
+
+   /* Puts UTF-8 text in a row,  starting at 'col' and clipped at the
+   right edge.  It's decoded with psf_decode_utf8(),  so invalid bytes
+   (including overlong forms and surrogates) are shown as U+FFFD.
+   Returns the number of cells used. */
+
+size_t fbcon_puts( struct fbcon *con, uint32_t col, const uint32_t row,
+               const char *utf8, const int fg, const int bg, const int attr)
+{
+   size_t len = strlen( utf8), rval = 0;
+
+   while( len && col < con->n_cols)
+      {
+      size_t n_bytes;
+      const uint32_t code_point = psf_decode_utf8( utf8, len, &n_bytes);
+
+      utf8 += n_bytes;
+      len -= n_bytes;
+      fbcon_put( con, col++, row, code_point, fg, bg, attr);
+      rval++;
+      }
+   return( rval);
+}
+
+void fbcon_clear( struct fbcon *con, const int bg)
+{
+   const size_t n_cells = (size_t)con->n_cols * con->n_rows;
+   size_t i;
+
+   for( i = 0; i < n_cells; i++)
+      {
+      con->cells[i].code_point = ' ';
+      con->cells[i].glyph = _find_glyph( con->font, ' ');
+      con->cells[i].fg = 7;
+      con->cells[i].bg = (uint8_t)( bg & (N_COLORS - 1));
+      con->cells[i].attr = 0;
+      }
+   _damage_all( con);
+}
+
+static struct glyph_cache *_get_cache( struct fbcon *con, const int fg, const int bg)
+{
+   struct glyph_cache **cache = con->caches + fg * N_COLORS + bg;
+
+   if( !*cache)
+      *cache = create_glyph_cache( con->font, con->bytes_per_pixel,
+                     con->palette[fg], con->palette[bg], con->cache_bytes);
+   return( *cache);
+}
+
+   /* Draws cells 'col0' to 'col1 - 1' of a row.  For each cell,  we get
+   the expanded glyph (and hence its pixel rows) once;  then each
+   scanline is assembled in con->span and copied out. */
+
+static size_t _draw_span( struct fbcon *con, const uint32_t row,
+                           const uint32_t col0, const uint32_t col1)
+{
+   const struct font_info *f = con->font;
+   const size_t cell_bytes = (size_t)f->width * con->bytes_per_pixel;
+   const size_t span_bytes = cell_bytes * (col1 - col0);
+   const uint8_t *glyph_pixels[MAX_SPAN];
+   uint8_t *dest = con->framebuffer + (size_t)row * f->height * con->line_length
+                                    + col0 * cell_bytes;
+   uint32_t col, y;
+
+   assert( col1 - col0 <= con->max_span);
+   for( col = col0; col < col1; col++)
+      {
+      const struct fbcon_cell *cell = con->cells + row * con->n_cols + col;
+      int fg = cell->fg | ((cell->attr & FBCON_BOLD) ? 8 : 0), bg = cell->bg;
+      struct glyph_cache *cache;
+
+      if( cell->attr & FBCON_REVERSE)
+         {
+         const int temp = fg;
+
+         fg = bg;
+         bg = temp;
+         }
+      cache = _get_cache( con, fg, bg);
+      glyph_pixels[col - col0] = (cache ? get_cached_glyph( cache, cell->glyph) : NULL);
+      }
+   for( y = 0; y < f->height; y++, dest += con->line_length)
+      {
+      uint8_t *tptr = con->span;
+
+      for( col = col0; col < col1; col++, tptr += cell_bytes)
+         {
+         const struct fbcon_cell *cell = con->cells + row * con->n_cols + col;
+
+         if( glyph_pixels[col - col0])
+            memcpy( tptr, glyph_pixels[col - col0] + y * cell_bytes, cell_bytes);
+         else
+            memset( tptr, 0, cell_bytes);
+         if( (cell->attr & FBCON_UNDERLINE) && y == f->height - 1)
+            {
+            const int fg = ((cell->attr & FBCON_REVERSE) ? cell->bg
+                     : cell->fg | ((cell->attr & FBCON_BOLD) ? 8 : 0));
+            uint32_t x;
+
+            for( x = 0; x < f->width; x++)
+               memcpy( tptr + x * con->bytes_per_pixel, con->pixels[fg],
+                              con->bytes_per_pixel);
+            }
+         }
+      memcpy( dest, con->span, span_bytes);
+      }
+   return( span_bytes * f->height);
+}
+
+   /* Redraws all damaged cells,  and returns the number of bytes
+   written to the framebuffer. */
+
+size_t fbcon_flush( struct fbcon *con)
+{
+   size_t rval = 0;
+   uint32_t row;
+
+   for( row = 0; row < con->n_rows; row++)
+      if( con->row_damaged[row])
+         {
+         uint32_t *damage = con->damage + row * con->words_per_row;
+         uint32_t col = 0;
+
+         while( col < con->n_cols)
+            {
+            uint32_t end;
+
+            if( !damage[col / 32])     /* skip 32 clean cells at once */
+               {
+               col = (col | 31) + 1;
+               continue;
+               }
+            if( !(damage[col / 32] & ((uint32_t)1 << (col & 31))))
+               {
+               col++;
+               continue;
+               }
+            end = col + 1;
+            while( end < con->n_cols && end - col < con->max_span
+                        && (damage[end / 32] & ((uint32_t)1 << (end & 31))))
+               end++;
+            rval += _draw_span( con, row, col, end);
+            col = end;
+            }
+         memset( damage, 0, con->words_per_row * sizeof( uint32_t));
+         con->row_damaged[row] = 0;
+         }
+   return( rval);
+}
@@ -0,0 +1,26 @@
+/* Text console on a framebuffer;  see fbcon.c */
+
+#define FBCON_BOLD        0x01       /* drawn in the bright (fg | 8) colour */
+#define FBCON_UNDERLINE   0x02
+#define FBCON_REVERSE     0x04
+
+struct fbcon;
+
+/* 'cache_bytes' is the size of _each_ glyph cache.  There's one per
+(foreground, background) pair actually drawn,  so up to 256 of them :
+memory use can reach 256 * cache_bytes,  though no cache grows beyond
+the whole font expanded to pixels.  */
+
+struct fbcon *create_fbcon( const struct font_info *f, uint8_t *framebuffer,
+               const uint32_t xres, const uint32_t yres, const size_t line_length,
+               const int bytes_per_pixel, const uint32_t *palette,
+               const size_t cache_bytes);
+void get_fbcon_size( const struct fbcon *con, uint32_t *n_cols, uint32_t *n_rows);
+void fbcon_put( struct fbcon *con, const uint32_t col, const uint32_t row,
+               const uint32_t code_point, const int fg, const int bg, const int attr);
+size_t fbcon_puts( struct fbcon *con, uint32_t col, const uint32_t row,
+               const char *utf8, const int fg, const int bg, const int attr);
+void fbcon_clear( struct fbcon *con, const int bg);
+size_t fbcon_flush( struct fbcon *con);
+void fbcon_set_framebuffer( struct fbcon *con, uint8_t *framebuffer);
+void free_fbcon( struct fbcon *con);
@@ -1,7 +1,18 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#ifndef _WIN32
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+#endif
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
 
 /* Code to read Unifont fonts in the ASCII .hex format,  and output
 them in PSF type 2 format.  Unifont is available in .hex (and other)
@@ -40,11 +51,71 @@ you run the full BMP Unifont .hex file,  or concatenate it with the SMP
 file,  you can make a relatively humongous .psf or .c file.  I usually
 edit the input to contain some subset of Unifont.
 
-   At present,  this is limited to 8x16 fonts.  In the following structure,
-'bits' contains 32 bytes,  to allow for possible 16x16 versions.  (PSF2
-assumes all glyphs are the same size.  For fullwidth characters and
-emoji,  we'll either need to make two fonts -- one 8x16,  one 16x16 --
-or modify the PSF2 format.) */
+   Compiling a multi-megabyte C array takes a while.  Instead,  you can
+write a binary font and add '-s stub_file.s' to get an assembler stub
+that pulls the font in with .incbin :
+
+./hex2psf2 input_file.hex font.psf -s font.s
+as -o font.o font.s         (or gcc -c font.s)
+
+   font.o then exports 'psf2_font' (the start of the font),
+'psf2_font_end',  and 'psf2_font_size' (a uint32_t),  and costs no
+compile time to speak of.  Declare them with
+
+extern const uint8_t psf2_font[], psf2_font_end[];
+extern const uint32_t psf2_font_size;
+
+   and pass psf2_font and psf2_font_size to load_psf_or_vgafont().  The
+font file is found relative to the directory the assembler runs in (or
+via its -I option).  With -w (see below),  the 16x16 font is included
+too,  as 'psf2_wide_font' and so on.  The stub uses GNU as syntax for
+ELF targets.
+
+   Unifont has both 8x16 glyphs (32 hex digits) and fullwidth 16x16
+ones (64 digits),  for CJK,  emoji and the like.  PSF2 assumes all glyphs
+are the same size,  so by default,  only the 8x16 glyphs are output.
+Add '-w wide_file' to put the 16x16 glyphs into a second font,  and
+'-i index_file' to write a combined index covering both fonts :
+
+   8 bytes   "HEXPSFIX"
+   uint32    number of entries
+   uint32    zero (reserved)
+   then,  for each glyph in either font,  two uint32s :  the code point,
+   and (font << 24) | glyph number,  where font 0 is the 8x16 font and 1
+   the 16x16 font.  (That's the packing psf.c uses for font sets.)
+
+   All values are little-endian.  The entries are in the order glyphs
+appear in the input,  which for Unifont (or with -j) means code point
+order,  so they can be binary-searched.  Each font also gets its own
+Unicode table,  so either can be used on its own.  With a C array,  the
+16x16 font is called 'psf2_wide_font'.
+
+   Many code points share identical bitmaps (blank and placeholder
+glyphs,  in particular).  With -d,  each distinct bitmap is written only
+once,  and all the code points using it are listed in that glyph's
+Unicode table entry (PSF2 allows any number).  That shrinks both the
+font and the C array.  The bitmaps are hashed as they're read,  in a
+single pass;  only the distinct ones are kept,  plus eight bytes per
+code point for the tables.  The index then maps code points to the
+shared glyphs.
+
+   Conversion is done in two passes over the input,  so that memory use
+doesn't depend on the number of glyphs (the full BMP and SMP together
+run to well over 100000 of them).  The first pass just counts glyphs
+and the size of the Unicode table,  which gives us the header and the
+array size.  The second streams each glyph's bitmap straight to the
+output,  and its Unicode table entry to a temporary file,  which is
+then appended to the output.  Hex digits are decoded through a lookup
+table rather than with sscanf(),  which was most of the run time;  with
+SSE2,  the glyph bits are decoded sixteen digits at a time.
+
+   With the -j option (-j4 for four threads,  or just -j to use one per
+CPU),  the input is instead mapped into memory and split into that many
+chunks at line boundaries.  Each thread parses its chunk into an array
+of glyphs;  these are then merged in code point order and written out.
+That uses memory in proportion to the input size,  but scales with the
+number of cores.  Unifont files are already in code point order,  so
+for them,  the output is the same as without -j. */
 
 typedef struct
 {
@@ -115,40 +186,124 @@ int PDC_wc_to_utf8( char *dest, const int32_t code)
    return( n_bytes_out);
 }
 
-/* At present,  just looks for 8x16 fonts */
+   /* hex_value[c] is the value of hex digit 'c',  or -1 if it isn't one. */
 
-static int get_font_bits( const char *buff, glyph_t *glyph)
+static int8_t hex_value[256];
+
+static void init_hex_values( void)
 {
-   int i, rval = -1;
-   const char *tptr = buff + 4;
-
-   if( *tptr != ':')
-      tptr++;
-   if( *tptr != ':')
-      tptr++;
-   if( *tptr == ':' && tptr[33] < ' ')
+   int i;
+
+   for( i = 0; i < 256; i++)
+      hex_value[i] = -1;
+   for( i = 0; i < 10; i++)
+      hex_value['0' + i] = (int8_t)i;
+   for( i = 0; i < 6; i++)
+      hex_value['A' + i] = hex_value['a' + i] = (int8_t)( i + 10);
+}
+
+   /* Decodes 'n_bytes' bytes (a multiple of 16) from twice that many
+   hex digits.  Returns -1 if any of them aren't hex digits.  The SSE2
+   version works out the value of sixteen digits at once,  then packs
+   pairs of nibbles into bytes. */
+
+static int decode_hex( const uint8_t *hex, uint8_t *out, const int n_bytes)
+{
+#ifdef __SSE2__
+   const __m128i zero_minus_one = _mm_set1_epi8( '0' - 1);
+   const __m128i nine_plus_one = _mm_set1_epi8( '9' + 1);
+   const __m128i a_minus_one = _mm_set1_epi8( 'a' - 1);
+   const __m128i f_plus_one = _mm_set1_epi8( 'f' + 1);
+   const __m128i zero = _mm_set1_epi8( '0');
+   const __m128i a_minus_ten = _mm_set1_epi8( 'a' - 10);
+   const __m128i lowercase = _mm_set1_epi8( 0x20);
+   const __m128i low_byte = _mm_set1_epi16( 0x00f0);
+   int i, j;
+
+   for( i = 0; i < n_bytes; i += 16)
       {
-      unsigned code_point = (unsigned)-1;
-
-      sscanf( buff, "%x", &code_point);
-      glyph->code_point = code_point;
-      glyph->height = 16;
-      glyph->width = 8;
-      tptr++;
-      for( i = 0; i < 16; i++)
+      __m128i packed[2];
+
+      for( j = 0; j < 2; j++)
          {
-         int digit1 = *tptr++ - '0';
-         int digit2 = *tptr++ - '0';
-
-         if( digit1 >= 10)
-            digit1 += 10 + '0' - 'A';
-         if( digit2 >= 10)
-            digit2 += 10 + '0' - 'A';
-         glyph->bits[i] = (char)( digit1 * 16 + digit2);
+         const __m128i digits = _mm_loadu_si128( (const __m128i *)( hex + 2 * i + 16 * j));
+         const __m128i lower = _mm_or_si128( digits, lowercase);
+         const __m128i is_digit = _mm_and_si128( _mm_cmpgt_epi8( digits, zero_minus_one),
+                                          _mm_cmplt_epi8( digits, nine_plus_one));
+         const __m128i is_alpha = _mm_and_si128( _mm_cmpgt_epi8( lower, a_minus_one),
+                                          _mm_cmplt_epi8( lower, f_plus_one));
+         const __m128i values = _mm_or_si128(
+                  _mm_and_si128( is_digit, _mm_sub_epi8( digits, zero)),
+                  _mm_and_si128( is_alpha, _mm_sub_epi8( lower, a_minus_ten)));
+
+         if( _mm_movemask_epi8( _mm_or_si128( is_digit, is_alpha)) != 0xffff)
+            return( -1);
+                  /* each 16-bit lane holds high nibble,  then low nibble */
+         packed[j] = _mm_or_si128(
+                  _mm_and_si128( _mm_slli_epi16( values, 4), low_byte),
+                  _mm_srli_epi16( values, 8));
          }
-      rval = 0;
+      _mm_storeu_si128( (__m128i *)( out + i), _mm_packus_epi16( packed[0], packed[1]));
       }
-   return( rval);
+#else
+   int i;
+
+   for( i = 0; i < n_bytes; i++, hex += 2)
+      {
+      const int digit1 = hex_value[hex[0]];
+      const int digit2 = hex_value[hex[1]];
+
+      if( digit1 < 0 || digit2 < 0)
+         return( -1);
+      out[i] = (uint8_t)( digit1 * 16 + digit2);
+      }
+#endif
+   return( 0);
+}
+
+/* Looks for 8x16 (32 digit) or 16x16 (64 digit) glyphs.  'len' is the
+length of the line,  which needn't be followed by a '\0' (or anything
+else). */
+
+static int get_font_bits( const char *buff, const size_t len, glyph_t *glyph)
+{
+   const uint8_t *tptr = (const uint8_t *)buff;
+   uint32_t code_point = 0;
+   size_t i;
+
+   for( i = 0; i < 6 && i < len && hex_value[*tptr] >= 0; i++)
+      code_point = (code_point << 4) | (uint32_t)hex_value[*tptr++];
+   if( i < 4 || i + 33 > len || *tptr++ != ':')
+      return( -1);
+   glyph->code_point = code_point;
+   glyph->height = 16;
+   glyph->width = 8;
+   if( i + 65 <= len && hex_value[tptr[32]] >= 0)
+      glyph->width = 16;
+   i += 1 + (size_t)glyph->width * 4;      /* past the last digit */
+   if( i < len && buff[i] >= ' ')
+      return( -1);
+   return( decode_hex( tptr, glyph->bits, glyph->width * 2));
+}
+
+   /* Reads a line into 'buff',  discarding anything that doesn't fit
+   (so that the end of an over-long line isn't taken for a new line). */
+
+static int get_line( char *buff, const int buffsize, FILE *ifile)
+{
+   size_t len;
+
+   if( !fgets( buff, buffsize, ifile))
+      return( -1);
+   len = strlen( buff);
+   if( len && buff[len - 1] != '\n')
+      {
+      int c;
+
+      while( (c = getc( ifile)) != EOF && c != '\n')
+         ;
+      }
+   return( 0);
 }
 
 static void _output_header( const struct psf2_header *hdr, FILE *ofile)
@@ -162,17 +317,21 @@ static void _output_header( const struct psf2_header *hdr, FILE *ofile)
             (unsigned)( hdr->length & 0xff),
             (unsigned)( hdr->length >> 8) & 0xff,
             (unsigned)( hdr->length >> 16), hdr->length);
-   fprintf( ofile, "    0x10, 0x00, 0x00, 0x00,   /* bytes/glyph */\n");
-   fprintf( ofile, "    0x10, 0x00, 0x00, 0x00,   /* glyph height (=16 pixels) */\n");
-   fprintf( ofile, "    0x08, 0x00, 0x00, 0x00,   /* glyph width (=8 pixels) */\n");
+   fprintf( ofile, "    0x%02x, 0x00, 0x00, 0x00,   /* bytes/glyph */\n",
+            (unsigned)hdr->charsize);
+   fprintf( ofile, "    0x%02x, 0x00, 0x00, 0x00,   /* glyph height (=%u pixels) */\n",
+            (unsigned)hdr->height, (unsigned)hdr->height);
+   fprintf( ofile, "    0x%02x, 0x00, 0x00, 0x00,   /* glyph width (=%u pixels) */\n",
+            (unsigned)hdr->width, (unsigned)hdr->width);
 }
 
 static void _output_glyph( const glyph_t *glyph, FILE *ofile)
 {
+   const int n_bytes = glyph->height * ((glyph->width + 7) / 8);
    int i;
 
    fprintf( ofile, " /* U+%x */ ", glyph->code_point);
-   for( i = 0; i < glyph->height; i++)
+   for( i = 0; i < n_bytes; i++)
       fprintf( ofile, " 0x%02x,", (unsigned char)glyph->bits[i]);
    fprintf( ofile, "\n");
 }
@@ -188,70 +347,573 @@ static void _output_utf8_info( const int code_point, const char *bytes,
    fprintf( ofile, "\n");
 }
 
-#define IS_POWER_OF_TWO( n)    (((n) & ((n)-1)) == 0)
+   /* We may be writing two fonts at once (see above),  so everything
+   about each is kept in one of these. */
 
-int main( const int argc, const char **argv)
+typedef struct
 {
-   FILE *ifile = fopen( argv[1], "rb"), *ofile;
    struct psf2_header hdr;
-   int i, n_glyphs = 0, write_c_array = (argc == 4);
-   int array_size = sizeof( struct psf2_header);
-   char buff[100];
-   glyph_t *glyph = (glyph_t *)malloc( sizeof( glyph_t));
+   FILE *ofile, *table_file;
+   int n_glyphs, n_written, array_size;
+   int n_points;              /* differs from n_glyphs only with -d */
+   uint8_t *bitmaps;          /* distinct bitmaps,  for -d */
+   uint32_t *hash_table, hash_mask;
+} out_font_t;
 
-   assert( argc == 3 || argc == 4);
-   assert( ifile);
-   hdr.magic[0] = PSF2_MAGIC0;
-   hdr.magic[1] = PSF2_MAGIC1;
-   hdr.magic[2] = PSF2_MAGIC2;
-   hdr.magic[3] = PSF2_MAGIC3;
-   hdr.flags = PSF2_HAS_UNICODE_TABLE;
-   hdr.width = 8;
-   hdr.height = hdr.charsize = 16;
-   hdr.version = 0;
-   while( fgets( buff, sizeof( buff), ifile))
-      if( !get_font_bits( buff, glyph + n_glyphs))
-         {
-         char utf8[5];
+   /* With -d,  the code points are kept as pairs of code point and
+   (font << 24) | glyph number,  in input order;  i.e.,  the index. */
 
-         array_size += hdr.charsize + 1 +
-                  PDC_wc_to_utf8( utf8, glyph[n_glyphs].code_point);
-         n_glyphs++;
-         if( IS_POWER_OF_TWO( n_glyphs))
-            glyph = (glyph_t *)realloc( glyph, 2 * n_glyphs * sizeof( glyph_t));
-         }
-   fclose( ifile);
+typedef struct
+{
+   uint32_t *data;
+   size_t n_used, n_alloced;
+} ref_list_t;
+
+static void _init_font( out_font_t *font, const int width)
+{
+   memset( font, 0, sizeof( out_font_t));
+   font->hdr.magic[0] = PSF2_MAGIC0;
+   font->hdr.magic[1] = PSF2_MAGIC1;
+   font->hdr.magic[2] = PSF2_MAGIC2;
+   font->hdr.magic[3] = PSF2_MAGIC3;
+   font->hdr.flags = PSF2_HAS_UNICODE_TABLE;
+   font->hdr.width = width;
+   font->hdr.height = 16;
+   font->hdr.charsize = 16 * ((width + 7) / 8);
+   font->hdr.version = 0;
+   font->hdr.headersize = sizeof( struct psf2_header);
+   font->array_size = sizeof( struct psf2_header);
+}
+
+   /* First pass :  just count the glyph and its bytes */
+
+static void _count_glyph( out_font_t *font, const glyph_t *glyph)
+{
+   char utf8[5];
+
+   font->array_size += font->hdr.charsize + 1 +
+                  PDC_wc_to_utf8( utf8, glyph->code_point);
+   font->n_glyphs++;
+   font->n_points++;
+}
 
-   ofile = fopen( argv[2], "wb");
-   assert( ofile);
-   hdr.headersize = sizeof( hdr);
-   hdr.length = n_glyphs;
+static uint32_t _hash_bitmap( const uint8_t *bits, const uint32_t n_bytes)
+{
+   uint32_t i, rval = 2166136261u;       /* FNV-1a */
+
+   for( i = 0; i < n_bytes; i++)
+      rval = (rval ^ bits[i]) * 16777619u;
+   return( rval);
+}
+
+   /* The table is kept at most half full;  it's doubled (and the
+   bitmaps given room for half as many glyphs) when it gets there. */
+
+static void _grow_hash_table( out_font_t *font)
+{
+   const uint32_t new_mask = font->hash_mask * 2 + 1;
+   const uint32_t charsize = font->hdr.charsize;
+   int i;
+
+   font->bitmaps = (uint8_t *)realloc( font->bitmaps,
+                     ((new_mask + 1) / 2) * charsize);
+   assert( font->bitmaps);
+   free( font->hash_table);
+   font->hash_table = (uint32_t *)malloc( (new_mask + 1) * sizeof( uint32_t));
+   assert( font->hash_table);
+   memset( font->hash_table, 0xff, (new_mask + 1) * sizeof( uint32_t));
+   font->hash_mask = new_mask;
+   for( i = 0; i < font->n_glyphs; i++)
+      {
+      uint32_t loc = _hash_bitmap( font->bitmaps + i * charsize, charsize) & new_mask;
+
+      while( font->hash_table[loc] != 0xffffffff)
+         loc = (loc + 1) & new_mask;
+      font->hash_table[loc] = (uint32_t)i;
+      }
+}
+
+   /* First (and only) pass with -d :  find the glyph's bitmap among those
+   seen so far,  adding it if it's new,  and note the code point. */
+
+static void _add_deduped( out_font_t *font, const uint32_t font_num,
+                        const glyph_t *glyph, ref_list_t *refs)
+{
+   const uint32_t charsize = font->hdr.charsize;
+   uint32_t loc;
+   char utf8[5];
+
+   if( (uint32_t)font->n_glyphs * 2 >= font->hash_mask)
+      _grow_hash_table( font);
+   loc = _hash_bitmap( glyph->bits, charsize) & font->hash_mask;
+   while( font->hash_table[loc] != 0xffffffff && memcmp( glyph->bits,
+               font->bitmaps + font->hash_table[loc] * charsize, charsize))
+      loc = (loc + 1) & font->hash_mask;
+   if( font->hash_table[loc] == 0xffffffff)
+      {
+      memcpy( font->bitmaps + font->n_glyphs * charsize, glyph->bits, charsize);
+      font->hash_table[loc] = (uint32_t)font->n_glyphs++;
+      font->array_size += charsize + 1;
+      }
+   font->array_size += PDC_wc_to_utf8( utf8, glyph->code_point);
+   font->n_points++;
+   if( refs->n_used == refs->n_alloced)
+      {
+      refs->n_alloced = refs->n_alloced * 2 + 1024;
+      refs->data = (uint32_t *)realloc( refs->data,
+                     refs->n_alloced * 2 * sizeof( uint32_t));
+      assert( refs->data);
+      }
+   refs->data[refs->n_used * 2] = glyph->code_point;
+   refs->data[refs->n_used * 2 + 1] = (font_num << 24) | font->hash_table[loc];
+   refs->n_used++;
+}
+
+static void _start_font( out_font_t *font, const char *filename,
+                     const char *array_name, const int write_c_array)
+{
+   font->ofile = fopen( filename, "wb");
+   assert( font->ofile);
+   font->table_file = tmpfile( );
+   assert( font->table_file);
+   font->hdr.length = font->n_glyphs;
    if( write_c_array)
       {
-      fprintf( ofile, "const unsigned char psf2_font[%d] = {\n", array_size);
-      _output_header( &hdr, ofile);
+      fprintf( font->ofile, "const unsigned char %s[%d] = {\n",
+                     array_name, font->array_size);
+      _output_header( &font->hdr, font->ofile);
+      }
+   else
+      fwrite( &font->hdr, 1, sizeof( font->hdr), font->ofile);
+}
+
+   /* Writes the glyph's bits to the output,  and its Unicode table
+   entry to the temporary file that is appended by _finish_font(). */
+
+static void _write_glyph( const glyph_t *glyph, out_font_t *font,
+                                    const int write_c_array)
+{
+   char utf8[5];
+   const int osize = PDC_wc_to_utf8( utf8, glyph->code_point);
+
+   utf8[osize] = (char)PSF2_SEPARATOR;
+   if( write_c_array)
+      {
+      _output_glyph( glyph, font->ofile);
+      _output_utf8_info( glyph->code_point, utf8, osize + 1, font->table_file);
       }
    else
-      fwrite( &hdr, 1, sizeof( hdr), ofile);
-   for( i = 0; i < n_glyphs; i++)
-      if( write_c_array)
-         _output_glyph( glyph + i, ofile);
-      else
-         fwrite( glyph[i].bits, hdr.charsize, 1, ofile);
-   for( i = 0; i < n_glyphs; i++)
       {
-      char utf8[5];
-      const int osize = PDC_wc_to_utf8( utf8, glyph[i].code_point);
+      fwrite( glyph->bits, font->hdr.charsize, 1, font->ofile);
+      fwrite( utf8, osize + 1, 1, font->table_file);
+      }
+   font->n_written++;
+}
 
-      utf8[osize] = (char)PSF2_SEPARATOR;
+   /* With -d,  the glyphs and their Unicode table entries come from
+   what _add_deduped() gathered.  The code points for each glyph are
+   gathered with a counting sort. */
+
+static void _write_deduped( out_font_t *font, const uint32_t font_num,
+                     const ref_list_t *refs, const int write_c_array)
+{
+   const uint32_t charsize = font->hdr.charsize;
+   uint32_t *offsets = (uint32_t *)calloc( font->n_glyphs + 1, sizeof( uint32_t));
+   uint32_t *points = (uint32_t *)malloc( (font->n_points + 1) * sizeof( uint32_t));
+   char *utf8 = (char *)malloc( font->n_points * 4 + 1);
+   size_t i;
+   int j;
+
+   assert( offsets && points && utf8);
+   for( i = 0; i < refs->n_used; i++)
+      if( (refs->data[i * 2 + 1] >> 24) == font_num)
+         offsets[(refs->data[i * 2 + 1] & 0xffffff) + 1]++;
+   for( j = 0; j < font->n_glyphs; j++)
+      offsets[j + 1] += offsets[j];
+   for( i = 0; i < refs->n_used; i++)
+      if( (refs->data[i * 2 + 1] >> 24) == font_num)
+         points[offsets[refs->data[i * 2 + 1] & 0xffffff]++] = refs->data[i * 2];
+   for( j = font->n_glyphs; j > 0; j--)       /* undo the increments */
+      offsets[j] = offsets[j - 1];
+   offsets[0] = 0;
+   for( j = 0; j < font->n_glyphs; j++)
+      {
+      uint32_t k;
+      int osize = 0;
+
+      for( k = offsets[j]; k < offsets[j + 1]; k++)
+         osize += PDC_wc_to_utf8( utf8 + osize, (int32_t)points[k]);
+      utf8[osize++] = (char)PSF2_SEPARATOR;
       if( write_c_array)
-         _output_utf8_info( glyph[i].code_point, utf8, osize + 1, ofile);
+         {
+         glyph_t glyph;
+
+         glyph.code_point = points[offsets[j]];
+         glyph.height = font->hdr.height;
+         glyph.width = font->hdr.width;
+         memcpy( glyph.bits, font->bitmaps + j * charsize, charsize);
+         _output_glyph( &glyph, font->ofile);
+         _output_utf8_info( glyph.code_point, utf8, osize, font->table_file);
+         }
       else
-         fwrite( utf8, osize + 1, 1, ofile);
+         {
+         fwrite( font->bitmaps + j * charsize, charsize, 1, font->ofile);
+         fwrite( utf8, osize, 1, font->table_file);
+         }
       }
-   free( glyph);
+   font->n_written = font->n_glyphs;
+   free( offsets);
+   free( points);
+   free( utf8);
+   free( font->bitmaps);
+   free( font->hash_table);
+}
+
+static void _finish_font( out_font_t *font, const int write_c_array)
+{
+   char buff[4096];
+   size_t n_read;
+
+   assert( font->n_written == font->n_glyphs);
+   rewind( font->table_file);
+   while( (n_read = fread( buff, 1, sizeof( buff), font->table_file)) > 0)
+      fwrite( buff, 1, n_read, font->ofile);
+   fclose( font->table_file);
    if( write_c_array)
-      fprintf( ofile, "};\n");
-   fclose( ofile);
+      fprintf( font->ofile, "};\n");
+   fclose( font->ofile);
+}
+
+static void _put32( FILE *ofile, const uint32_t ival)
+{
+   fputc( (int)( ival & 0xff), ofile);
+   fputc( (int)( (ival >> 8) & 0xff), ofile);
+   fputc( (int)( (ival >> 16) & 0xff), ofile);
+   fputc( (int)( ival >> 24), ofile);
+}
+
+static void _write_incbin( FILE *ofile, const char *symbol, const char *filename)
+{
+   fprintf( ofile, "   .global %s\n", symbol);
+   fprintf( ofile, "   .global %s_end\n", symbol);
+   fprintf( ofile, "   .global %s_size\n", symbol);
+   fprintf( ofile, "   .type %s, @object\n", symbol);
+   fprintf( ofile, "   .balign 16\n");
+   fprintf( ofile, "%s:\n", symbol);
+   fprintf( ofile, "   .incbin \"");
+   for( ; *filename; filename++)       /* escape for an assembler string */
+      if( *filename == '"' || *filename == '\\')
+         fprintf( ofile, "\\%c", *filename);
+      else if( (unsigned char)*filename < ' ')
+         fprintf( ofile, "\\%03o", (unsigned)(unsigned char)*filename);
+      else
+         fputc( *filename, ofile);
+   fprintf( ofile, "\"\n");
+   fprintf( ofile, "%s_end:\n", symbol);
+   fprintf( ofile, "   .size %s, %s_end - %s\n", symbol, symbol, symbol);
+   fprintf( ofile, "   .balign 4\n");
+   fprintf( ofile, "   .type %s_size, @object\n", symbol);
+   fprintf( ofile, "%s_size:\n", symbol);
+   fprintf( ofile, "   .long %s_end - %s\n", symbol, symbol);
+   fprintf( ofile, "   .size %s_size, 4\n\n", symbol);
+}
+
+   /* See the comments at top about '-s'. */
+
+static int _write_asm_stub( const char *stub_filename, const char *font_filename,
+                              const char *wide_filename)
+{
+   FILE *ofile = fopen( stub_filename, "wb");
+
+   if( !ofile)
+      return( -1);
+   fprintf( ofile, "/* Made by hex2psf2;  see hex2psf2.c */\n");
+   fprintf( ofile, "   .section .rodata\n");
+   _write_incbin( ofile, "psf2_font", font_filename);
+   if( wide_filename)
+      _write_incbin( ofile, "psf2_wide_font", wide_filename);
+   fprintf( ofile, "   .section .note.GNU-stack,\"\",@progbits\n");
+   return( fclose( ofile));
+}
+
+   /* 'fonts[0]' is the 8x16 font;  'fonts[1]' the 16x16 one,  if we're
+   making it.  Returns the font the glyph belongs in,  or NULL if it's
+   16x16 and we're not. */
+
+static out_font_t *_font_for( const glyph_t *glyph, out_font_t *fonts,
+                                          const int make_wide)
+{
+   if( glyph->width == 8)
+      return( fonts);
+   return( make_wide ? fonts + 1 : NULL);
+}
+
+typedef struct
+{
+   const char *start, *end;
+   glyph_t *glyphs;
+   int n_glyphs;
+} hex_chunk_t;
+
+static void *parse_chunk( void *arg)
+{
+   hex_chunk_t *chunk = (hex_chunk_t *)arg;
+   const char *tptr = chunk->start;
+
+   while( tptr < chunk->end)
+      {
+      const char *eol = (const char *)memchr( tptr, '\n', chunk->end - tptr);
+
+      if( !eol)
+         eol = chunk->end;
+      if( !get_font_bits( tptr, eol - tptr, chunk->glyphs + chunk->n_glyphs))
+         chunk->n_glyphs++;
+      tptr = eol + 1;
+      }
+   return( NULL);
+}
+
+static const glyph_t *sort_glyphs;
+
+static int compare_glyph_indices( const void *a, const void *b)
+{
+   const uint32_t idx_a = *(const uint32_t *)a;
+   const uint32_t idx_b = *(const uint32_t *)b;
+   const uint32_t cp_a = sort_glyphs[idx_a].code_point;
+   const uint32_t cp_b = sort_glyphs[idx_b].code_point;
+
+   if( cp_a != cp_b)
+      return( cp_a > cp_b ? 1 : -1);
+   return( (idx_a > idx_b) - (idx_a < idx_b));      /* keep input order */
+}
+
+   /* Reads the whole input (mapping it into memory,  if we can),  then
+   parses it in 'n_threads' chunks at once.  Each chunk can have at most
+   one glyph per 38 bytes (four-digit code point,  colon,  32 digits,
+   line feed),  so that's how much room it gets.  The glyphs found are
+   returned in code point order,  with the number of them in *n_found. */
+
+static glyph_t *parse_in_parallel( const char *filename, int n_threads,
+                                    int *n_found)
+{
+   const char *data;
+   size_t len, max_glyphs, i;
+   hex_chunk_t *chunks;
+   pthread_t *threads;
+   glyph_t *glyphs, *sorted;
+   uint32_t *order;
+   int n_glyphs = 0, j, in_order = 1;
+#ifdef _WIN32
+   FILE *ifile = fopen( filename, "rb");
+   char *buff;
+
+   assert( ifile);
+   fseek( ifile, 0L, SEEK_END);
+   len = (size_t)ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   buff = (char *)malloc( len + 1);
+   assert( buff);
+   if( fread( buff, 1, len, ifile) != len)
+      len = 0;
+   fclose( ifile);
+   data = buff;
+#else
+   const int fd = open( filename, O_RDONLY);
+   struct stat st;
+
+   assert( fd >= 0);
+   fstat( fd, &st);
+   len = (size_t)st.st_size;
+   data = (len ? (const char *)mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : "");
+   assert( data != (const char *)MAP_FAILED);
+   close( fd);
+#endif
+   if( (size_t)n_threads > len / 4096 + 1)   /* don't bother splitting tiny files */
+      n_threads = (int)( len / 4096 + 1);
+   max_glyphs = len / 38 + (size_t)n_threads + 1;
+   chunks = (hex_chunk_t *)calloc( n_threads, sizeof( hex_chunk_t));
+   threads = (pthread_t *)malloc( n_threads * sizeof( pthread_t));
+   glyphs = (glyph_t *)malloc( max_glyphs * sizeof( glyph_t));
+   assert( chunks && threads && glyphs);
+   for( j = 0, i = 0; j < n_threads; j++)
+      {
+      size_t end = (j == n_threads - 1 ? len : len * (j + 1) / n_threads);
+
+      while( end < len && end && data[end - 1] != '\n')
+         end++;
+      if( end < i)
+         end = i;
+      chunks[j].start = data + i;
+      chunks[j].end = data + end;
+      chunks[j].glyphs = glyphs + i / 38 + j;
+      i = end;
+      }
+   for( j = 0; j < n_threads; j++)
+      pthread_create( threads + j, NULL, parse_chunk, chunks + j);
+   for( j = 0; j < n_threads; j++)
+      {
+      pthread_join( threads[j], NULL);
+      memmove( glyphs + n_glyphs, chunks[j].glyphs,
+                              chunks[j].n_glyphs * sizeof( glyph_t));
+      n_glyphs += chunks[j].n_glyphs;
+      }
+#ifdef _WIN32
+   free( buff);
+#else
+   if( len)
+      munmap( (void *)data, len);
+#endif
+   free( chunks);
+   free( threads);
+   for( j = 1; j < n_glyphs && in_order; j++)
+      in_order = (glyphs[j - 1].code_point <= glyphs[j].code_point);
+   *n_found = n_glyphs;
+   if( in_order)
+      return( glyphs);
+   order = (uint32_t *)malloc( n_glyphs * sizeof( uint32_t));
+   sorted = (glyph_t *)malloc( n_glyphs * sizeof( glyph_t));
+   assert( order && sorted);
+   for( j = 0; j < n_glyphs; j++)
+      order[j] = (uint32_t)j;
+   sort_glyphs = glyphs;
+   qsort( order, n_glyphs, sizeof( uint32_t), compare_glyph_indices);
+   for( j = 0; j < n_glyphs; j++)
+      sorted[j] = glyphs[order[j]];
+   free( order);
+   free( glyphs);
+   return( sorted);
+}
+
+int main( const int argc, const char **argv)
+{
+   FILE *ifile = NULL, *index_file = NULL;
+   int i, n_glyphs = 0, write_c_array = 0, n_threads = 0;
+   int n_args = 0, make_wide, dedup = 0;
+   size_t j;
+   ref_list_t refs;
+   char buff[300];
+   const char *args[3], *wide_filename = NULL, *index_filename = NULL;
+   const char *stub_filename = NULL;
+   glyph_t glyph, *glyphs = NULL;
+   out_font_t fonts[2], *font;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] == 'j')
+         {
+         n_threads = atoi( argv[i] + 2);
+#ifndef _WIN32
+         if( n_threads <= 0)
+            n_threads = (int)sysconf( _SC_NPROCESSORS_ONLN);
+#endif
+         if( n_threads <= 0)
+            n_threads = 1;
+         }
+      else if( !strcmp( argv[i], "-w") && i < argc - 1)
+         wide_filename = argv[++i];
+      else if( !strcmp( argv[i], "-s") && i < argc - 1)
+         stub_filename = argv[++i];
+      else if( !strcmp( argv[i], "-d"))
+         dedup = 1;
+      else if( !strcmp( argv[i], "-i") && i < argc - 1)
+         index_filename = argv[++i];
+      else if( n_args < 3)
+         args[n_args++] = argv[i];
+   assert( n_args == 2 || n_args == 3);
+   write_c_array = (n_args == 3);
+   if( write_c_array && stub_filename)
+      {
+      fprintf( stderr, "An assembler stub needs a binary font,  not a C array\n");
+      return( -1);
+      }
+   make_wide = (wide_filename != NULL);
+   init_hex_values( );
+   _init_font( fonts, 8);
+   _init_font( fonts + 1, 16);
+   memset( &refs, 0, sizeof( refs));
+   if( n_threads)
+      glyphs = parse_in_parallel( args[0], n_threads, &n_glyphs);
+   else
+      {
+      ifile = fopen( args[0], "rb");
+      assert( ifile);
+      }
+   for( i = 0; glyphs ? i < n_glyphs : !get_line( buff, sizeof( buff), ifile); i++)
+      {
+      const glyph_t *gptr = glyphs + i;
+
+      if( !glyphs)         /* first pass */
+         {
+         if( get_font_bits( buff, strlen( buff), &glyph))
+            continue;
+         gptr = &glyph;
+         }
+      if( (font = _font_for( gptr, fonts, make_wide)) != NULL)
+         {
+         if( dedup)
+            _add_deduped( font, (uint32_t)( font - fonts), gptr, &refs);
+         else
+            _count_glyph( font, gptr);
+         }
+      }
+
+   _start_font( fonts, args[1], "psf2_font", write_c_array);
+   if( make_wide)
+      _start_font( fonts + 1, wide_filename, "psf2_wide_font", write_c_array);
+   if( index_filename)
+      {
+      index_file = fopen( index_filename, "wb");
+      assert( index_file);
+      fwrite( "HEXPSFIX", 8, 1, index_file);
+      _put32( index_file, (uint32_t)( fonts[0].n_points
+                     + (make_wide ? fonts[1].n_points : 0)));
+      _put32( index_file, 0);
+      }
+   if( dedup)
+      {
+      for( j = 0; index_file && j < refs.n_used * 2; j++)
+         _put32( index_file, refs.data[j]);
+      _write_deduped( fonts, 0, &refs, write_c_array);
+      if( make_wide)
+         _write_deduped( fonts + 1, 1, &refs, write_c_array);
+      free( refs.data);
+      }
+   else if( ifile)
+      rewind( ifile);
+   for( i = 0; !dedup && (glyphs ? i < n_glyphs
+                     : !get_line( buff, sizeof( buff), ifile)); i++)
+      {
+      const glyph_t *gptr = glyphs + i;
+
+      if( !glyphs)         /* second pass */
+         {
+         if( get_font_bits( buff, strlen( buff), &glyph))
+            continue;
+         gptr = &glyph;
+         }
+      font = _font_for( gptr, fonts, make_wide);
+      if( font && font->n_written < font->n_glyphs)
+         {
+         if( index_file)
+            {
+            _put32( index_file, gptr->code_point);
+            _put32( index_file, (uint32_t)( font - fonts) << 24
+                                 | (uint32_t)font->n_written);
+            }
+         _write_glyph( gptr, font, write_c_array);
+         }
+      }
+   if( ifile)
+      fclose( ifile);
+   free( glyphs);
+   _finish_font( fonts, write_c_array);
+   if( make_wide)
+      _finish_font( fonts + 1, write_c_array);
+   if( index_file)
+      fclose( index_file);
+   if( stub_filename && _write_asm_stub( stub_filename, args[1], wide_filename))
+      {
+      fprintf( stderr, "Couldn't write '%s'\n", stub_filename);
+      return( -1);
+      }
    return( 0);
 }
@@ -2,6 +2,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdio.h>
+#ifndef _WIN32
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/mman.h>
+   #include <sys/stat.h>
+#endif
+#ifdef __SSE2__
+   #include <emmintrin.h>
+#endif
 #include "psf.h"
 
 /* Code for the PSF font format,  both psf1 and psf2,  as
@@ -12,21 +22,18 @@ https://www.win.tue.nl/~aeb/linux/kbd/font-formats-1.html
    and for the (much simpler) 'vgafont' font format;  see _load_vgafont()
 below. The PSF fonts can contain Unicode information,  a table basically
 saying "Unicode point x corresponds to glyph y".  This code reads that
-information (if it's provided) and sorts it by Unicode point,  so that
-when the glyph for a given Unicode point is desired,  we can
-binary-search for it. */
+information (if it's provided) and sorts it by Unicode point.
 
+   Binary-searching that table costs a dozen or more dependent cache
+misses per lookup for a large (Unifont-sized) font,  which adds up when
+redrawing a full screen of text.  So once the table is read,  we also
+build a two-level lookup index,  much as a CPU maps virtual memory :
+the Unicode point,  shifted right eight bits,  gets you a 'page' number;
+that page is an array of 256 glyph numbers.  Pages in which the font
+has no glyphs at all share a single empty page (page 0),  so the index
+stays small.  Page 1 is always U+0 to U+FF,  so ASCII and Latin-1
+lookups can skip the first level entirely.  See _build_lookup_index(). */
 
-#define PSF1_MAGIC0     0x36
-#define PSF1_MAGIC1     0x04
-
-#define PSF1_MODE512    0x01
-#define PSF1_MODEHASTAB 0x02
-#define PSF1_MODEHASSEQ 0x04
-#define PSF1_MAXMODE    0x05
-
-#define PSF1_SEPARATOR  0xFFFF
-#define PSF1_STARTSEQ   0xFFFE
 
 struct psf1_header {
         unsigned char magic[2];     /* Magic number */
@@ -34,14 +41,299 @@ struct psf1_header {
         unsigned char charsize;     /* Character size */
 };
 
+   /* Compare by code point,  then glyph number.  (Just subtracting
+   the values can overflow.)  Only used if _sort_unicode_info() can't
+   get memory for its radix sort. */
+
 static int _compare_unicode_info( const void *a, const void *b)
 {
-   const int32_t diff = *(int32_t *)a - *(int32_t *)b;
+   const uint32_t *a0 = (const uint32_t *)a;
+   const uint32_t *b0 = (const uint32_t *)b;
+
+   if( a0[0] != b0[0])
+      return( a0[0] > b0[0] ? 1 : -1);
+   return( (a0[1] > b0[1]) - (a0[1] < b0[1]));
+}
+
+/* The Unicode table is sorted by code point with a radix sort :  two
+passes of eleven bits each,  which covers all of Unicode (21 bits).
+Each pass is stable,  so if a point maps to several glyphs,  they stay
+in glyph order.  Fonts made from Unifont (and many others) list their
+glyphs in Unicode order,  so we first check to see if the table is
+already sorted;  if it is,  there's nothing to do. */
+
+#define RADIX_BITS  11
+#define RADIX_SIZE  (1 << RADIX_BITS)
+
+static void _sort_unicode_info( uint32_t *info, const uint32_t n)
+{
+   uint32_t i, pass, *temp;
+   uint32_t count[RADIX_SIZE];
+
+   for( i = 1; i < n && info[i + i - 2] <= info[i + i]; i++)
+      ;
+   if( i >= n)          /* already sorted */
+      return;
+   for( i = 0; i < n; i++)
+      if( info[i + i] >> (2 * RADIX_BITS))
+         break;
+   temp = (i == n ? (uint32_t *)malloc( n * 2 * sizeof( uint32_t)) : NULL);
+   if( !temp)        /* out of memory,  or points out of range */
+      {
+      qsort( info, n, 2 * sizeof( uint32_t), _compare_unicode_info);
+      return;
+      }
+   for( pass = 0; pass < 2; pass++)
+      {
+      const int shift = pass * RADIX_BITS;
+      uint32_t *from = (pass ? temp : info), *to = (pass ? info : temp);
+      uint32_t total = 0;
+
+      memset( count, 0, sizeof( count));
+      for( i = 0; i < n; i++)
+         count[(from[i + i] >> shift) & (RADIX_SIZE - 1)]++;
+      for( i = 0; i < RADIX_SIZE; i++)
+         {
+         const uint32_t tval = count[i];
+
+         count[i] = total;
+         total += tval;
+         }
+      for( i = 0; i < n; i++)
+         {
+         uint32_t *dest = to + 2 * count[(from[i + i] >> shift) & (RADIX_SIZE - 1)]++;
+
+         dest[0] = from[i + i];
+         dest[1] = from[i + i + 1];
+         }
+      }
+   free( temp);
+}
+
+#define REPLACEMENT_CHARACTER 0xfffd
+
+   /* Decodes one UTF-8 character.  Anything that isn't well-formed UTF-8
+   -- a stray continuation byte,  a truncated sequence,  an overlong form,
+   a surrogate,  or a value past U+10FFFF -- gives U+FFFD,  consuming
+   one byte.  The second byte's range depends on the first;  see the
+   table in section 3.9 of the Unicode standard. */
+
+static uint32_t _decode_utf8( const uint8_t *text, const size_t len, size_t *n_bytes)
+{
+   uint32_t rval = REPLACEMENT_CHARACTER;
+   uint8_t lo = 0x80, hi = 0xbf;
+   size_t n = 0, i;
+
+   *n_bytes = 1;
+   if( text[0] < 0x80)
+      return( text[0]);
+   if( (text[0] & 0xe0) == 0xc0 && text[0] >= 0xc2)
+      {
+      n = 2;
+      rval = text[0] & 0x1f;
+      }
+   else if( (text[0] & 0xf0) == 0xe0)
+      {
+      n = 3;
+      rval = text[0] & 0x0f;
+      }
+   else if( (text[0] & 0xf8) == 0xf0 && text[0] < 0xf5)
+      {
+      n = 4;
+      rval = text[0] & 0x07;
+      }
+   if( !n || n > len)
+      return( REPLACEMENT_CHARACTER);
+   if( text[0] == 0xe0)          /* overlong */
+      lo = 0xa0;
+   else if( text[0] == 0xed)     /* surrogate */
+      hi = 0x9f;
+   else if( text[0] == 0xf0)     /* overlong */
+      lo = 0x90;
+   else if( text[0] == 0xf4)     /* past U+10FFFF */
+      hi = 0x8f;
+   if( text[1] < lo || text[1] > hi)
+      return( REPLACEMENT_CHARACTER);
+   for( i = 1; i < n; i++)
+      {
+      if( (text[i] & 0xc0) != 0x80)
+         return( REPLACEMENT_CHARACTER);
+      rval = (rval << 6) | (text[i] & 0x3f);
+      }
+   *n_bytes = n;
+   return( rval);
+}
+
+uint32_t psf_decode_utf8( const char *utf8, const size_t len, size_t *n_bytes)
+{
+   return( _decode_utf8( (const uint8_t *)utf8, len, n_bytes));
+}
+
+
+/* Both PSF formats allow a glyph to be given for a _sequence_ of Unicode
+points,  such as a base character plus combining accents.  After the
+single points for a glyph,  each sequence is introduced by PSF1_STARTSEQ
+or PSF2_STARTSEQ.  These are gathered while reading the table as
+[glyph number, length, points...] records,  then built into a trie :
+an array of nodes,  each holding one code point,  the glyph to use if
+the sequence ends there (or -1),  and the range of its children,  which
+are stored next to each other and sorted so they can be binary-searched.
+Node 0 is the root;  its children are the points that start sequences.
+
+   Very few code points start a sequence,  so we also keep a 4096-bit
+filter,  indexed by the low twelve bits of the first code point.  If
+that bit is clear,  there is no sequence to look for,  and looking up
+the glyph costs one more memory access than looking up a single point.
+See find_psf_or_vgafont_sequence(). */
+
+struct seq_buffer {
+   uint32_t *data;
+   size_t n_used, n_alloced;
+   size_t start;           /* start of sequence being read */
+   int in_sequence;
+   uint32_t n_sequences, n_points;
+};
+
+static void _add_to_sequence( struct seq_buffer *seqs, const uint32_t ival)
+{
+   if( seqs->n_used == seqs->n_alloced)
+      {
+      const size_t new_size = seqs->n_alloced * 2 + 64;
+      uint32_t *new_data = (uint32_t *)realloc( seqs->data,
+                                    new_size * sizeof( uint32_t));
+
+      if( !new_data)
+         return;
+      seqs->data = new_data;
+      seqs->n_alloced = new_size;
+      }
+   seqs->data[seqs->n_used++] = ival;
+}
+
+static void _end_sequence( struct seq_buffer *seqs)
+{
+   if( seqs->in_sequence)
+      {
+      const uint32_t len = (uint32_t)( seqs->n_used - seqs->start - 2);
+
+      if( len && seqs->n_used > seqs->start + 2)
+         {
+         seqs->data[seqs->start + 1] = len;
+         seqs->n_sequences++;
+         seqs->n_points += len;
+         }
+      else        /* empty sequence;  forget it */
+         seqs->n_used = seqs->start;
+      seqs->in_sequence = 0;
+      }
+}
+
+static void _start_sequence( struct seq_buffer *seqs, const uint32_t glyph_num)
+{
+   _end_sequence( seqs);
+   seqs->start = seqs->n_used;
+   _add_to_sequence( seqs, glyph_num);
+   _add_to_sequence( seqs, 0);         /* length filled in at the end */
+   seqs->in_sequence = (seqs->n_used == seqs->start + 2);
+   if( !seqs->in_sequence)
+      seqs->n_used = seqs->start;
+}
+
+   /* Sequence records compare by code points,  then by length (so a
+   sequence comes before any that extend it),  then by glyph number. */
+
+static int _compare_sequences( const void *a, const void *b)
+{
+   const uint32_t *seq_a = *(const uint32_t * const *)a;
+   const uint32_t *seq_b = *(const uint32_t * const *)b;
+   const uint32_t len = (seq_a[1] < seq_b[1] ? seq_a[1] : seq_b[1]);
+   uint32_t i;
 
-   return( (int)diff);
+   for( i = 2; i < len + 2; i++)
+      if( seq_a[i] != seq_b[i])
+         return( seq_a[i] > seq_b[i] ? 1 : -1);
+   if( seq_a[1] != seq_b[1])
+      return( seq_a[1] > seq_b[1] ? 1 : -1);
+   return( (seq_a[0] > seq_b[0]) - (seq_a[0] < seq_b[0]));
 }
 
-static int _load_psf1( struct font_info *f, const uint8_t *buff, const long filelen)
+/* 'seqs' points to 'n' sorted sequences,  all of which share their
+first 'depth' points and have at least that many;  'node' is the
+trie node for that prefix.  Set its glyph,  then lay out its children
+next to one another,  then fill in each child in turn. */
+
+static void _fill_trie_node( struct font_info *f, const uint32_t **seqs,
+                     size_t n, const uint32_t depth, const uint32_t node)
+{
+   const uint32_t first_child = f->n_seq_nodes;
+   uint32_t n_children = 0;
+   size_t i, j;
+
+   f->seq_nodes[node].glyph = -1;
+   while( n && seqs[0][1] == depth)
+      {                 /* sequence ends here */
+      if( f->seq_nodes[node].glyph < 0)
+         f->seq_nodes[node].glyph = (int32_t)seqs[0][0];
+      seqs++;
+      n--;
+      }
+   for( i = 0; i < n; i = j)
+      {
+      const uint32_t unicode_point = seqs[i][depth + 2];
+
+      f->seq_nodes[f->n_seq_nodes++].unicode_point = unicode_point;
+      for( j = i + 1; j < n && seqs[j][depth + 2] == unicode_point; j++)
+         ;
+      }
+   f->seq_nodes[node].first_child = first_child;
+   f->seq_nodes[node].n_children = f->n_seq_nodes - first_child;
+   for( i = 0; i < n; i = j)
+      {
+      const uint32_t unicode_point = seqs[i][depth + 2];
+
+      for( j = i + 1; j < n && seqs[j][depth + 2] == unicode_point; j++)
+         ;
+      _fill_trie_node( f, seqs + i, j - i, depth + 1, first_child + n_children++);
+      }
+}
+
+static void _build_sequence_trie( struct font_info *f, struct seq_buffer *seqs)
+{
+   const uint32_t **sorted = NULL;
+   size_t i, n = 0;
+
+   if( seqs->n_sequences)
+      {
+      sorted = (const uint32_t **)malloc( seqs->n_sequences * sizeof( uint32_t *));
+      f->seq_nodes = (struct psf_seq_node *)malloc(
+                  (seqs->n_points + 1) * sizeof( struct psf_seq_node));
+      }
+   if( sorted && f->seq_nodes)
+      {
+      for( i = 0; i < seqs->n_used; i += seqs->data[i + 1] + 2)
+         sorted[n++] = seqs->data + i;
+      qsort( sorted, n, sizeof( uint32_t *), _compare_sequences);
+      f->seq_nodes[0].unicode_point = 0;
+      f->n_seq_nodes = 1;
+      _fill_trie_node( f, sorted, n, 0, 0);
+      for( i = 0; i < f->seq_nodes[0].n_children; i++)
+         {
+         const uint32_t bit = f->seq_nodes[i + 1].unicode_point & 0xfff;
+
+         f->seq_filter[bit >> 5] |= (uint32_t)1 << (bit & 0x1f);
+         }
+      }
+   else
+      {
+      free( f->seq_nodes);
+      f->seq_nodes = NULL;
+      }
+   free( sorted);
+   free( seqs->data);
+}
+
+static int _load_psf1( struct font_info *f, const uint8_t *buff, const long filelen,
+                                             const int parse_table)
 {
    struct psf1_header hdr;
    int n_references_found = 0;
@@ -55,21 +347,36 @@ static int _load_psf1( struct font_info *f, const uint8_t *buff, const long file
    f->charsize = f->height = hdr.charsize;
    f->width = 8;
    f->glyphs = buff + f->headersize;
+   f->unicode_table_offset = 0;
    if( hdr.mode & PSF1_MODEHASTAB)
+      f->unicode_table_offset = 4 + f->n_glyphs * hdr.charsize;
+   if( f->unicode_table_offset && parse_table)
       {
-      size_t i = (size_t) 4 + f->n_glyphs * hdr.charsize;
+      size_t i = (size_t)f->unicode_table_offset;
       unsigned glyph_num = 0;
-      unsigned max_info_size = (unsigned)( (filelen - i) / 2 - f->n_glyphs);
-      uint32_t *tptr = (uint32_t *)malloc( max_info_size * 2 * sizeof( uint32_t));
+      const unsigned max_info_size = (i < (size_t)filelen ?
+                                 (unsigned)( (filelen - i) / 2) : 0);
+      uint32_t *tptr = (uint32_t *)malloc( (max_info_size + 1) * 2 * sizeof( uint32_t));
+      struct seq_buffer seqs;
 
+      if( !tptr)
+         return( -1);
+      memset( &seqs, 0, sizeof( seqs));
       f->unicode_info = tptr;
-      for( ; i < (size_t)filelen; i += 2)
+      for( ; i + 1 < (size_t)filelen; i += 2)
          {
          const unsigned ival = buff[i] | ((unsigned)buff[i + 1] << 8);
 
          if( ival == PSF1_SEPARATOR)
+            {
+            _end_sequence( &seqs);
             glyph_num++;
-         else if( ival != PSF1_STARTSEQ)
+            }
+         else if( ival == PSF1_STARTSEQ)
+            _start_sequence( &seqs, glyph_num);
+         else if( seqs.in_sequence)
+            _add_to_sequence( &seqs, (uint32_t)ival);
+         else
             {
             assert( n_references_found < (int)max_info_size);
             *tptr++ = (uint32_t)ival;
@@ -77,8 +384,9 @@ static int _load_psf1( struct font_info *f, const uint8_t *buff, const long file
             n_references_found++;
             }
          }
-      qsort( f->unicode_info, n_references_found, 2 * sizeof( uint32_t),
-                              _compare_unicode_info);
+      _end_sequence( &seqs);
+      _sort_unicode_info( f->unicode_info, n_references_found);
+      _build_sequence_trie( f, &seqs);
       }
    else
       f->unicode_info = NULL;
@@ -86,21 +394,6 @@ static int _load_psf1( struct font_info *f, const uint8_t *buff, const long file
    return( 0);
 }
 
-#define PSF2_MAGIC0     0x72
-#define PSF2_MAGIC1     0xb5
-#define PSF2_MAGIC2     0x4a
-#define PSF2_MAGIC3     0x86
-
-/* bits used in flags */
-#define PSF2_HAS_UNICODE_TABLE 0x01
-
-/* max version recognized so far */
-#define PSF2_MAXVERSION 0
-
-/* UTF8 separators */
-#define PSF2_SEPARATOR  0xFF
-#define PSF2_STARTSEQ   0xFE
-
 struct psf2_header {
         uint8_t magic[4];
         uint32_t version;
@@ -112,9 +405,8 @@ struct psf2_header {
         /* charsize = height * ((width + 7) / 8) */
 };
 
-#define IS_UTF8_STARTING_BYTE( c) (!((c) & 0x80) || ((c) > 0xc1 && (c) < 0xf5))
-
-static int _load_psf2( struct font_info *f, const uint8_t *buff, const long filelen)
+static int _load_psf2( struct font_info *f, const uint8_t *buff, const long filelen,
+                                             const int parse_table)
 {
    struct psf2_header hdr;
    int n_references_found = 0;
@@ -130,47 +422,65 @@ static int _load_psf2( struct font_info *f, const uint8_t *buff, const long file
    f->height = hdr.height;
    f->width = hdr.width;
    f->glyphs = buff + f->headersize;
+   f->unicode_table_offset = 0;
    if( hdr.flags & PSF2_HAS_UNICODE_TABLE)
+      f->unicode_table_offset = hdr.headersize + hdr.length * hdr.charsize;
+   if( f->unicode_table_offset && parse_table)
       {
-      size_t i = (size_t)( hdr.headersize + hdr.length * hdr.charsize);
+      size_t i = (size_t)f->unicode_table_offset;
+      const size_t max_info_size = (i < (size_t)filelen ? (size_t)filelen - i : 0);
       unsigned glyph_num = 0;
-      int j, n1 = 0;
       uint32_t *tptr;
+      struct seq_buffer seqs;
 
-      for( j = (int)i ; j < (int)filelen; j++)
-         if( IS_UTF8_STARTING_BYTE( buff[j]))
-            n1++;
-      f->unicode_info = tptr = (uint32_t *)malloc( n1 * 2 * sizeof( uint32_t));
-      for( ; i < (size_t)filelen; i++)
+            /* Each entry takes at least one byte of the table,  so
+            we can allocate for the worst case,  decode in one pass,
+            and then shrink the result to fit. */
+      memset( &seqs, 0, sizeof( seqs));
+      f->unicode_info = tptr = (uint32_t *)malloc( (max_info_size + 1) * 2 * sizeof( uint32_t));
+      if( !f->unicode_info)
+         return( -1);
+      while( i < (size_t)filelen)
          if( buff[i] == PSF2_SEPARATOR)
+            {
+            _end_sequence( &seqs);
             glyph_num++;
-         else if( buff[i] != PSF2_STARTSEQ)
+            i++;
+            }
+         else if( buff[i] == PSF2_STARTSEQ)
             {
-            unsigned cval;    /* decipher UTF8 value */
+            _start_sequence( &seqs, glyph_num);
+            i++;
+            }
+         else
+            {
+            uint32_t cval;
 
             if( !(buff[i] & 0x80))           /* plain ASCII */
-               cval = (unsigned)buff[i];
-            else if( (buff[i] & 0xe0) == 0xc0) /* two-byte UTF8 : code */
-               {                               /* points U+80 to U+7FF */
-               cval = ((buff[i] & 0x1f) << 6) | (buff[i + 1] & 0x3f);
-               i++;
+               cval = buff[i++];
+            else
+               {
+               size_t n_bytes;
+
+               cval = _decode_utf8( buff + i, (size_t)filelen - i, &n_bytes);
+               i += n_bytes;
                }
+            if( seqs.in_sequence)
+               _add_to_sequence( &seqs, cval);
             else
-               {           /* three-byte UTF: U+800 to U+FFFF */
-               cval = ((buff[i] & 0x0f) << 12) | ((buff[i + 1] & 0x3f) << 6) | (buff[i + 2] & 0x3f);
-               if( (buff[i] & 0xf0) == 0xf0)     /* Four-byte UTF:  */
-                  {                              /* U+10000 and beyond (SMP) */
-                  cval = (cval << 6) | (buff[i + 3] & 0x3f);
-                  i++;
-                  }
-               i += 2;
+               {
+               *tptr++ = cval;
+               *tptr++ = glyph_num;
+               n_references_found++;
                }
-            *tptr++ = cval;
-            *tptr++ = glyph_num;
-            n_references_found++;
             }
-      qsort( f->unicode_info, n_references_found, 2 * sizeof( uint32_t),
-                              _compare_unicode_info);
+      _end_sequence( &seqs);
+      tptr = (uint32_t *)realloc( f->unicode_info,
+                        (n_references_found + 1) * 2 * sizeof( uint32_t));
+      if( tptr)
+         f->unicode_info = tptr;
+      _sort_unicode_info( f->unicode_info, n_references_found);
+      _build_sequence_trie( f, &seqs);
       }
    else
       f->unicode_info = NULL;
@@ -194,6 +504,7 @@ static int _load_vgafont( struct font_info *f, const uint8_t *buff, const long f
       {
       f->unicode_info = NULL;
       f->unicode_info_size = 0;
+      f->unicode_table_offset = 0;
       f->font_type = 0;
       f->n_glyphs = 256;
       f->headersize = 0;
@@ -204,28 +515,1273 @@ static int _load_vgafont( struct font_info *f, const uint8_t *buff, const long f
       }
 }
 
-int load_psf_or_vgafont( struct font_info *f, const uint8_t *buff, const long filelen)
+#define MAX_UNICODE_POINT     0x10ffff
+#define N_TOP_LEVEL_ENTRIES  ((MAX_UNICODE_POINT >> 8) + 1)
+
+static int _build_lookup_index( struct font_info *f)
 {
-   if( _load_psf1( f, buff, filelen) && _load_psf2( f, buff, filelen)
+   uint16_t *page_index;
+   uint32_t i, n_pages = 2;      /* empty page + Latin-1 page */
+
+   page_index = (uint16_t *)calloc( N_TOP_LEVEL_ENTRIES, sizeof( uint16_t));
+   if( !page_index)
+      return( -1);
+   page_index[0] = 1;
+   for( i = 0; i < f->unicode_info_size; i++)
+      {
+      const uint32_t page = f->unicode_info[i + i] >> 8;
+
+      if( page < N_TOP_LEVEL_ENTRIES && !page_index[page])
+         page_index[page] = (uint16_t)n_pages++;
+      }
+   f->pages = (int32_t *)malloc( n_pages * 256 * sizeof( int32_t));
+   if( !f->pages)
+      {
+      free( page_index);
+      return( -1);
+      }
+   memset( f->pages, 0xff, n_pages * 256 * sizeof( int32_t));
+   for( i = 0; i < f->unicode_info_size; i++)
+      {
+      const uint32_t unicode_point = f->unicode_info[i + i];
+
+      if( unicode_point <= MAX_UNICODE_POINT)
+         {          /* if a point maps to several glyphs,  use the first */
+         int32_t *tptr = f->pages + page_index[unicode_point >> 8] * 256
+                                  + (unicode_point & 0xff);
+         const int32_t glyph_num = (int32_t)f->unicode_info[i + i + 1];
+
+         if( *tptr < 0 || *tptr > glyph_num)
+            *tptr = glyph_num;
+         }
+      }
+   f->page_index = page_index;
+   f->n_pages = n_pages;
+   return( 0);
+}
+
+static int _load_font( struct font_info *f, const uint8_t *buff, const long filelen,
+                                             const int parse_table)
+{
+   f->unicode_info = NULL;
+   f->unicode_info_size = 0;
+   f->page_index = NULL;
+   f->pages = NULL;
+   f->n_pages = 0;
+   f->seq_nodes = NULL;
+   f->n_seq_nodes = 0;
+   memset( f->seq_filter, 0, sizeof( f->seq_filter));
+   f->mapping = NULL;
+   f->mapping_len = 0;
+   f->index_mapping = NULL;
+   f->index_mapping_len = 0;
+   f->owned_glyphs = NULL;
+   f->variants = f->next_variant = NULL;
+   f->variant_key = 0;
+   if( _load_psf1( f, buff, filelen, parse_table)
+                     && _load_psf2( f, buff, filelen, parse_table)
                      && _load_vgafont( f, buff, filelen))
       return( -1);
+   if( f->unicode_info && _build_lookup_index( f))
+      {
+      free_psf_or_vgafont( f);
+      return( -1);
+      }
+   return( 0);
+}
+
+int load_psf_or_vgafont( struct font_info *f, const uint8_t *buff, const long filelen)
+{
+   return( _load_font( f, buff, filelen, 1));
+}
+
+static void _free_variants( struct font_info *f);
+
+void free_psf_or_vgafont( struct font_info *f)
+{
+   _free_variants( f);
+#ifndef _WIN32
+   if( f->index_mapping)      /* index came from the cache;  see below */
+      munmap( f->index_mapping, f->index_mapping_len);
    else
+#endif
+      {
+      free( f->unicode_info);
+      free( f->page_index);
+      free( f->pages);
+      free( f->seq_nodes);
+      }
+   f->index_mapping = NULL;
+   f->index_mapping_len = 0;
+   f->unicode_info = NULL;
+   f->page_index = NULL;
+   f->pages = NULL;
+   f->seq_nodes = NULL;
+   f->unicode_info_size = f->n_pages = f->n_seq_nodes = 0;
+   if( f->owned_glyphs)
+      {
+      free( f->owned_glyphs);
+      f->owned_glyphs = NULL;
+      f->glyphs = NULL;
+      }
+}
+
+/* FNV-1a,  but eating eight bytes at a time,  so that checking a
+large index isn't much slower than reading it.   */
+
+uint64_t psf_hash( const void *data, size_t len)
+{
+   const uint8_t *bytes = (const uint8_t *)data;
+   const uint64_t prime = (uint64_t)0x100000001b3;
+   uint64_t rval = (uint64_t)0xcbf29ce484222325;
+
+   while( len >= 8)
+      {
+      uint64_t word;
+
+      memcpy( &word, bytes, 8);
+      rval = (rval ^ word) * prime;
+      rval ^= rval >> 29;
+      bytes += 8;
+      len -= 8;
+      }
+   while( len--)
+      rval = (rval ^ *bytes++) * prime;
+   return( rval);
+}
+
+#ifndef _WIN32
+
+/* Reading the Unicode table,  decoding it,  sorting it and building the
+lookup index is most of the work of loading a big font.  So
+open_psf_or_vgafont() keeps the result in a cache directory : a file
+holding the sorted 'unicode_info' table,  then the page index,  then the
+pages,  all exactly as they are laid out in memory.  On later opens,
+that file is just memory-mapped and the pointers set to point into it.
+
+   The cache file is named for a hash of the font's Unicode table,  so
+identical fonts share a cache file no matter where they live.  Its
+header records the font size and table hash (checked against the font
+being opened),  a format version,  and a checksum of the rest of the
+file (so a truncated or damaged file is just rebuilt).  Byte order and
+layout are those of the machine that wrote it;  a file from a machine
+that differs would fail the size and checksum tests,  and be rebuilt.
+
+   The cache directory is $PSF_INDEX_CACHE,  if that's set;  if it's set
+to an empty string,  caching is turned off.  Otherwise,  it's
+$XDG_CACHE_HOME/psf-index or $HOME/.cache/psf-index.  Any failure to
+read or write the cache just means we fall back to parsing the font. */
+
+#define INDEX_CACHE_MAGIC     "PSFINDX"
+#define INDEX_CACHE_VERSION   2
+
+struct index_cache_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t font_len;
+        uint64_t table_hash;       /* hash of font's Unicode table */
+        uint32_t unicode_info_size;
+        uint32_t n_pages;
+        uint32_t n_seq_nodes;
+        uint32_t seq_filter[128];
+        uint32_t reserved;
+        uint64_t checksum;         /* hash of everything after header */
+};
+
+static size_t _index_cache_size( const uint32_t unicode_info_size,
+                        const uint32_t n_pages, const uint32_t n_seq_nodes)
+{
+   return( sizeof( struct index_cache_header)
+               + unicode_info_size * 2 * sizeof( uint32_t)
+               + N_TOP_LEVEL_ENTRIES * sizeof( uint16_t)
+               + n_pages * 256 * sizeof( int32_t)
+               + n_seq_nodes * sizeof( struct psf_seq_node));
+}
+
+/* Sets 'filename' to the name of a file in a cache directory,  named
+for 'hash' with the given extension.  The directory is $(env_var),  or
+$XDG_CACHE_HOME/(subdir),  or $HOME/.cache/(subdir),  and is created if
+need be.  Returns -1 if there's no usable cache directory (including
+if $(env_var) is set to an empty string,  meaning "don't cache").  Also
+used by psf_gz.c. */
+
+int psf_cache_filename( char *filename, const size_t max_len,
+                  const char *env_var, const char *subdir,
+                  const uint64_t hash, const char *extension)
+{
+   const char *dir = getenv( env_var);
+   const char *dir_subdir = "";
+   int len;
+
+   if( dir && !*dir)       /* caching turned off */
+      return( -1);
+   if( !dir)
+      {
+      dir = getenv( "XDG_CACHE_HOME");
+      dir_subdir = subdir;
+      }
+   if( !dir || !*dir)
+      {
+      const char *home = getenv( "HOME");
+      char cache_dir[300];
+
+      if( !home || !*home)
+         return( -1);
+      snprintf( cache_dir, sizeof( cache_dir), "%s/.cache", home);
+      mkdir( cache_dir, 0755);      /* may well already exist */
+      len = snprintf( filename, max_len, "%s%s", cache_dir, subdir);
+      }
+   else
+      len = snprintf( filename, max_len, "%s%s", dir, dir_subdir);
+   if( len <= 0 || (size_t)len + 20 + strlen( extension) >= max_len)
+      return( -1);
+   mkdir( filename, 0755);
+   snprintf( filename + len, max_len - len, "/%016llx.%s",
+                        (unsigned long long)hash, extension);
+   return( 0);
+}
+
+static void _write_index_cache( const struct font_info *f, const char *filename,
+                     const uint64_t font_len, const uint64_t table_hash)
+{
+   struct index_cache_header hdr;
+   const size_t info_bytes = f->unicode_info_size * 2 * sizeof( uint32_t);
+   const size_t index_bytes = N_TOP_LEVEL_ENTRIES * sizeof( uint16_t);
+   const size_t page_bytes = f->n_pages * 256 * sizeof( int32_t);
+   const size_t seq_bytes = f->n_seq_nodes * sizeof( struct psf_seq_node);
+   const size_t payload_len = info_bytes + index_bytes + page_bytes + seq_bytes;
+   uint8_t *payload = (uint8_t *)malloc( payload_len);
+   char temp_name[320];
+   FILE *ofile;
+   int fd;
+
+   if( !payload)
+      return;
+   memcpy( payload, f->unicode_info, info_bytes);
+   memcpy( payload + info_bytes, f->page_index, index_bytes);
+   memcpy( payload + info_bytes + index_bytes, f->pages, page_bytes);
+   if( seq_bytes)
+      memcpy( payload + info_bytes + index_bytes + page_bytes,
+                                    f->seq_nodes, seq_bytes);
+   memset( &hdr, 0, sizeof( hdr));
+   memcpy( hdr.magic, INDEX_CACHE_MAGIC, sizeof( INDEX_CACHE_MAGIC));
+   hdr.version = INDEX_CACHE_VERSION;
+   hdr.header_size = sizeof( hdr);
+   hdr.font_len = font_len;
+   hdr.table_hash = table_hash;
+   hdr.unicode_info_size = f->unicode_info_size;
+   hdr.n_pages = f->n_pages;
+   hdr.n_seq_nodes = f->n_seq_nodes;
+   memcpy( hdr.seq_filter, f->seq_filter, sizeof( hdr.seq_filter));
+   hdr.checksum = psf_hash( payload, payload_len);
+            /* write to a temporary file,  then rename,  so that anyone
+            else opening the font never sees a partly-written file.  The
+            name comes from mkstemp(),  so other processes or threads
+            writing the same cache at the same time get their own file. */
+   snprintf( temp_name, sizeof( temp_name), "%s.XXXXXX", filename);
+   fd = mkstemp( temp_name);
+   ofile = (fd >= 0 ? fdopen( fd, "wb") : NULL);
+   if( fd >= 0 && !ofile)
+      {
+      close( fd);
+      unlink( temp_name);
+      }
+   if( ofile)
+      {
+      const int okay = (fwrite( &hdr, sizeof( hdr), 1, ofile) == 1
+                     && fwrite( payload, payload_len, 1, ofile) == 1);
+
+      if( !fclose( ofile) && okay)
+         rename( temp_name, filename);
+      else
+         unlink( temp_name);
+      }
+   free( payload);
+}
+
+static int _map_index_cache( struct font_info *f, const char *filename,
+                     const uint64_t font_len, const uint64_t table_hash)
+{
+   struct stat st;
+   struct index_cache_header hdr;
+   uint8_t *mapping;
+   const int fd = open( filename, O_RDONLY);
+
+   if( fd < 0)
+      return( -1);
+   if( fstat( fd, &st) || (size_t)st.st_size < sizeof( hdr))
+      {
+      close( fd);
+      return( -1);
+      }
+   mapping = (uint8_t *)mmap( NULL, (size_t)st.st_size, PROT_READ,
+                                          MAP_SHARED, fd, 0);
+   close( fd);
+   if( mapping == MAP_FAILED)
+      return( -1);
+   memcpy( &hdr, mapping, sizeof( hdr));
+   if( memcmp( hdr.magic, INDEX_CACHE_MAGIC, sizeof( INDEX_CACHE_MAGIC))
+            || hdr.version != INDEX_CACHE_VERSION
+            || hdr.header_size != sizeof( hdr)
+            || hdr.font_len != font_len || hdr.table_hash != table_hash
+            || hdr.n_pages > N_TOP_LEVEL_ENTRIES + 1
+            || (size_t)st.st_size != _index_cache_size( hdr.unicode_info_size,
+                                          hdr.n_pages, hdr.n_seq_nodes)
+            || hdr.checksum != psf_hash( mapping + sizeof( hdr),
+                                       (size_t)st.st_size - sizeof( hdr)))
+      {
+      munmap( mapping, (size_t)st.st_size);
+      return( -1);
+      }
+   f->unicode_info_size = hdr.unicode_info_size;
+   f->n_pages = hdr.n_pages;
+   f->unicode_info = (uint32_t *)( mapping + sizeof( hdr));
+   f->page_index = (uint16_t *)( f->unicode_info + 2 * hdr.unicode_info_size);
+   f->pages = (int32_t *)( f->page_index + N_TOP_LEVEL_ENTRIES);
+   f->n_seq_nodes = hdr.n_seq_nodes;
+   if( hdr.n_seq_nodes)
+      f->seq_nodes = (struct psf_seq_node *)( f->pages + 256 * hdr.n_pages);
+   memcpy( f->seq_filter, hdr.seq_filter, sizeof( hdr.seq_filter));
+   f->index_mapping = mapping;
+   f->index_mapping_len = (size_t)st.st_size;
+   return( 0);
+}
+
+/* Called by open_psf_or_vgafont() with the font header loaded,  but
+not the Unicode table.  Get the index from the cache if we can;  if
+not,  parse the table and (try to) save the result in the cache. */
+
+static int _load_unicode_index( struct font_info *f, const uint8_t *buff,
+                                                const size_t len)
+{
+   const size_t table_len = (f->unicode_table_offset < len ?
+                              len - f->unicode_table_offset : 0);
+   const uint64_t table_hash = psf_hash( buff + f->unicode_table_offset, table_len);
+   char filename[300];
+   const int use_cache = !psf_cache_filename( filename, sizeof( filename),
+                        "PSF_INDEX_CACHE", "/psf-index", table_hash, "idx");
+
+   if( use_cache && !_map_index_cache( f, filename, (uint64_t)len, table_hash))
       return( 0);
+   if( _load_font( f, buff, (long)len, 1))
+      return( -1);
+   if( use_cache && f->unicode_info)
+      _write_index_cache( f, filename, (uint64_t)len, table_hash);
+   return( 0);
 }
+#endif
 
-int find_psf_or_vgafont_glyph( struct font_info *f, const uint32_t unicode_point)
+/* Rather than have the caller read the font into memory and then call
+load_psf_or_vgafont(),  one can just open the file by name.  The file is
+memory-mapped read-only,  and the glyphs are used directly from the
+mapping;  nothing is copied,  and processes using the same font file
+share the same physical pages.  Only the Unicode index is allocated.
+Release the font with close_psf_or_vgafont().  (On Windows,  we just
+read the file into an allocated buffer.) */
+
+int open_psf_or_vgafont( struct font_info *f, const char *filename)
 {
-   int rval = -1;
+   void *mapping;
+   size_t len;
+   int rval;
+#ifdef _WIN32
+   FILE *ifile = fopen( filename, "rb");
+   long filelen;
 
-   if( f->unicode_info)
+   if( !ifile)
+      return( -1);
+   fseek( ifile, 0L, SEEK_END);
+   filelen = ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   len = (size_t)filelen;
+   mapping = (filelen > 0 ? malloc( len) : NULL);
+   if( mapping && fread( mapping, len, 1, ifile) != 1)
       {
-      const uint32_t *tptr = (const uint32_t *)bsearch( &unicode_point, f->unicode_info,
-                  f->unicode_info_size, 2 * sizeof( uint32_t), _compare_unicode_info);
+      free( mapping);
+      mapping = NULL;
+      }
+   fclose( ifile);
+   if( !mapping)
+      return( -1);
+#else
+   struct stat st;
+   const int fd = open( filename, O_RDONLY);
 
-      if( tptr)
-         rval = (int)( tptr[1]);
+   if( fd < 0)
+      return( -1);
+   if( fstat( fd, &st) || st.st_size <= 0)
+      {
+      close( fd);
+      return( -1);
+      }
+   len = (size_t)st.st_size;
+   mapping = mmap( NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+   close( fd);
+   if( mapping == MAP_FAILED)
+      return( -1);
+#endif
+#ifdef _WIN32
+   rval = load_psf_or_vgafont( f, (const uint8_t *)mapping, (long)len);
+#else
+   rval = _load_font( f, (const uint8_t *)mapping, (long)len, 0);
+   if( !rval && f->unicode_table_offset)
+      rval = _load_unicode_index( f, (const uint8_t *)mapping, len);
+#endif
+   f->mapping = mapping;
+   f->mapping_len = len;
+   if( rval)
+      close_psf_or_vgafont( f);
+   return( rval);
+}
+
+void close_psf_or_vgafont( struct font_info *f)
+{
+   free_psf_or_vgafont( f);
+   if( f->mapping)
+#ifdef _WIN32
+      free( f->mapping);
+#else
+      munmap( f->mapping, f->mapping_len);
+#endif
+   f->mapping = NULL;
+   f->mapping_len = 0;
+   f->glyphs = NULL;
+}
+
+int find_psf_or_vgafont_glyph( const struct font_info *f, const uint32_t unicode_point)
+{
+   int rval = -1;
+
+   if( f->pages)
+      {
+      if( unicode_point < 256)           /* ASCII/Latin-1 fast path */
+         rval = (int)f->pages[256 + unicode_point];
+      else if( unicode_point <= MAX_UNICODE_POINT)
+         rval = (int)f->pages[f->page_index[unicode_point >> 8] * 256
+                                    + (unicode_point & 0xff)];
       }
    else if( unicode_point < f->n_glyphs)
       rval = (int)unicode_point;
    return( rval);
 }
+
+/* Converting a whole string at a time saves a function call per
+character,  and lets us deal with runs of plain ASCII (the usual case
+for terminal text) quickly :  we check 16 bytes at a time (eight,  if
+SSE2 isn't available) for any with the high bit set.  For those that
+don't have it set,  the glyph numbers come straight out of the Latin-1
+page with no decoding or branching.  Other UTF-8 sequences are decoded
+and looked up inline,  a run at a time;  the ASCII scan only starts
+again at the next byte below 0x80,  so that text with few or no ASCII
+characters doesn't pay for setting it up after every character.
+Invalid bytes are treated as U+FFFD (the replacement character),  one
+per byte.  'glyphs' must have room for one entry per input byte;  the
+return value is the number of code points (and glyph numbers) found.
+Unfound glyphs are -1. */
+
+static size_t _ascii_run_length( const uint8_t *text, const size_t len)
+{
+   size_t rval = 0;
+
+#ifdef __SSE2__
+   while( rval + 16 <= len)
+      {
+      const __m128i bytes = _mm_loadu_si128( (const __m128i *)( text + rval));
+      const int mask = _mm_movemask_epi8( bytes);
+
+      if( mask)
+         return( rval + (size_t)__builtin_ctz( (unsigned)mask));
+      rval += 16;
+      }
+#endif
+   while( rval + 8 <= len)
+      {
+      uint64_t word;
+
+      memcpy( &word, text + rval, 8);
+      if( word & (uint64_t)0x8080808080808080)
+         break;
+      rval += 8;
+      }
+   while( rval < len && !(text[rval] & 0x80))
+      rval++;
+   return( rval);
+}
+
+size_t psf_utf8_to_glyphs( const struct font_info *f, const char *utf8,
+                                 const size_t len, int32_t *glyphs)
+{
+   const uint8_t *text = (const uint8_t *)utf8;
+   const int32_t *latin1 = (f->pages ? f->pages + 256 : NULL);
+   size_t i = 0, n_out = 0;
+
+   while( i < len)
+      if( text[i] < 0x80)
+         {
+         size_t run = 0;
+         const uint8_t *end, *tptr = text + i;
+
+               /* Check a few bytes one at a time first;  in mixed text,
+               ASCII often comes singly (spaces between CJK words,  say) */
+         while( run < 8 && i + run < len && text[i + run] < 0x80)
+            run++;
+         if( run == 8)
+            run += _ascii_run_length( text + i + 8, len - i - 8);
+         end = text + i + run;
+
+         if( latin1)
+            while( tptr < end)
+               glyphs[n_out++] = latin1[*tptr++];
+         else
+            while( tptr < end)
+               {
+               glyphs[n_out++] = (*tptr < f->n_glyphs ? (int32_t)*tptr : -1);
+               tptr++;
+               }
+         i += run;
+         }
+      else        /* decode non-ASCII until we're back to ASCII */
+         do
+            {
+            const uint8_t c0 = text[i];
+            uint32_t unicode_point;
+
+            if( c0 >= 0xe0 && c0 < 0xf0 && i + 2 < len
+                     && (text[i + 1] & 0xc0) == 0x80 && (text[i + 2] & 0xc0) == 0x80
+                     && (c0 != 0xe0 || text[i + 1] >= 0xa0)
+                     && (c0 != 0xed || text[i + 1] < 0xa0))
+               {        /* three-byte sequences (most of the BMP) inline,
+                        except overlongs and surrogates,  which
+                        _decode_utf8() turns into U+FFFD */
+               unicode_point = ((uint32_t)( c0 & 0x0f) << 12)
+                     | ((uint32_t)( text[i + 1] & 0x3f) << 6) | (text[i + 2] & 0x3f);
+               i += 3;
+               }
+            else if( c0 >= 0xc2 && c0 < 0xe0 && i + 1 < len
+                     && (text[i + 1] & 0xc0) == 0x80)
+               {
+               unicode_point = ((uint32_t)( c0 & 0x1f) << 6) | (text[i + 1] & 0x3f);
+               i += 2;
+               }
+            else
+               {
+               size_t n_bytes;
+
+               unicode_point = _decode_utf8( text + i, len - i, &n_bytes);
+               i += n_bytes;
+               }
+            if( !latin1)
+               glyphs[n_out++] = (unicode_point < f->n_glyphs ? (int32_t)unicode_point : -1);
+            else if( unicode_point < 256)
+               glyphs[n_out++] = latin1[unicode_point];
+            else if( unicode_point <= MAX_UNICODE_POINT)
+               glyphs[n_out++] = f->pages[f->page_index[unicode_point >> 8] * 256
+                                    + (unicode_point & 0xff)];
+            else
+               glyphs[n_out++] = -1;
+            }
+            while( i < len && text[i] >= 0x80);
+   return( n_out);
+}
+
+size_t psf_utf32_to_glyphs( const struct font_info *f, const uint32_t *text,
+                                 const size_t len, int32_t *glyphs)
+{
+   size_t i;
+
+   for( i = 0; i < len; i++)
+      glyphs[i] = (int32_t)find_psf_or_vgafont_glyph( f, text[i]);
+   return( len);
+}
+
+/* Finds the glyph for the longest sequence of code points,  starting
+at text[0],  that the font has a glyph for.  Usually,  that'll just be
+the glyph for text[0] alone,  and *n_used will be set to 1.  But if the
+font has,  say,  a glyph for 'e' plus a combining acute accent,  and
+that's what 'text' starts with,  you'll get that glyph and *n_used = 2.
+If there's no glyph for text[0],  but there is one for a longer
+sequence,  we return that.  -1 is returned (with *n_used = 1) if no
+glyph is found at all. */
+
+int find_psf_or_vgafont_sequence( const struct font_info *f, const uint32_t *text,
+                                 const size_t len, size_t *n_used)
+{
+   int rval;
+   uint32_t bit;
+
+   assert( len);
+   bit = text[0] & 0xfff;
+   rval = find_psf_or_vgafont_glyph( f, text[0]);
+   *n_used = 1;
+   if( f->seq_nodes && len > 1
+               && (f->seq_filter[bit >> 5] & ((uint32_t)1 << (bit & 0x1f))))
+      {
+      const struct psf_seq_node *node = f->seq_nodes;
+      size_t i;
+
+      for( i = 0; i < len && node->n_children; i++)
+         {
+         const struct psf_seq_node *children = f->seq_nodes + node->first_child;
+         uint32_t lo = 0, hi = node->n_children;
+
+         while( lo < hi)
+            {
+            const uint32_t mid = (lo + hi) / 2;
+
+            if( children[mid].unicode_point < text[i])
+               lo = mid + 1;
+            else
+               hi = mid;
+            }
+         if( lo == node->n_children || children[lo].unicode_point != text[i])
+            break;
+         node = children + lo;
+         if( node->glyph >= 0 && (i || rval < 0))
+            {
+            rval = (int)node->glyph;
+            *n_used = i + 1;
+            }
+         }
+      }
+   return( rval);
+}
+
+/* Large fonts (Unifont in particular) often contain many glyphs that
+are byte-for-byte identical :  blanks,  'replacement' boxes,  and so on.
+compact_psf_or_vgafont() hashes each glyph bitmap,  keeps one copy of
+each distinct bitmap in a newly allocated buffer,  and renumbers the
+Unicode index (and any sequences) to match.  Glyph numbers thus change;
+lookups through find_psf_or_vgafont_glyph() and friends give the same
+bitmaps as before.  A font without a Unicode table is first given one
+mapping each glyph number to itself,  so that lookups still work after
+the glyphs are renumbered.
+
+   If the index came from the cache (see above),  it's read-only,  so
+it's copied to allocated memory before being modified.  Returns the
+number of bytes of glyph data saved,  or -1 if memory ran out (in which
+case the font is left as it was). */
+
+static int _copy_mapped_index( struct font_info *f)
+{
+   const size_t info_bytes = f->unicode_info_size * 2 * sizeof( uint32_t);
+   const size_t index_bytes = N_TOP_LEVEL_ENTRIES * sizeof( uint16_t);
+   const size_t page_bytes = f->n_pages * 256 * sizeof( int32_t);
+   const size_t seq_bytes = f->n_seq_nodes * sizeof( struct psf_seq_node);
+   uint32_t *unicode_info = (uint32_t *)malloc( info_bytes + 1);
+   uint16_t *page_index = (uint16_t *)malloc( index_bytes);
+   int32_t *pages = (int32_t *)malloc( page_bytes);
+   struct psf_seq_node *seq_nodes = (seq_bytes ?
+                  (struct psf_seq_node *)malloc( seq_bytes) : NULL);
+
+   if( !unicode_info || !page_index || !pages || (seq_bytes && !seq_nodes))
+      {
+      free( unicode_info);
+      free( page_index);
+      free( pages);
+      free( seq_nodes);
+      return( -1);
+      }
+   memcpy( unicode_info, f->unicode_info, info_bytes);
+   memcpy( page_index, f->page_index, index_bytes);
+   memcpy( pages, f->pages, page_bytes);
+   if( seq_bytes)
+      memcpy( seq_nodes, f->seq_nodes, seq_bytes);
+#ifndef _WIN32
+   munmap( f->index_mapping, f->index_mapping_len);
+#endif
+   f->index_mapping = NULL;
+   f->index_mapping_len = 0;
+   f->unicode_info = unicode_info;
+   f->page_index = page_index;
+   f->pages = pages;
+   f->seq_nodes = seq_nodes;
+   return( 0);
+}
+
+static int _add_identity_table( struct font_info *f)
+{
+   uint32_t i;
+
+   f->unicode_info = (uint32_t *)malloc( f->n_glyphs * 2 * sizeof( uint32_t));
+   if( !f->unicode_info)
+      return( -1);
+   for( i = 0; i < f->n_glyphs; i++)
+      f->unicode_info[i + i] = f->unicode_info[i + i + 1] = i;
+   f->unicode_info_size = f->n_glyphs;
+   if( _build_lookup_index( f))
+      {
+      free( f->unicode_info);
+      f->unicode_info = NULL;
+      f->unicode_info_size = 0;
+      return( -1);
+      }
+   return( 0);
+}
+
+long compact_psf_or_vgafont( struct font_info *f)
+{
+   const size_t charsize = f->charsize;
+   uint32_t i, n_unique = 0, hash_mask = 1;
+   uint32_t *remap, *table;
+   uint8_t *unique, *shrunk;
+   long rval;
+
+   _free_variants( f);          /* their glyph numbers would be wrong */
+   if( f->index_mapping && _copy_mapped_index( f))
+      return( -1);
+   if( !f->pages && _add_identity_table( f))
+      return( -1);
+   while( hash_mask < f->n_glyphs * 2)
+      hash_mask <<= 1;
+   table = (uint32_t *)malloc( hash_mask * sizeof( uint32_t));
+   remap = (uint32_t *)malloc( f->n_glyphs * sizeof( uint32_t));
+   unique = (uint8_t *)malloc( f->n_glyphs * charsize + 1);
+   if( !table || !remap || !unique)
+      {
+      free( table);
+      free( remap);
+      free( unique);
+      return( -1);
+      }
+   memset( table, 0xff, hash_mask * sizeof( uint32_t));
+   hash_mask--;
+   for( i = 0; i < f->n_glyphs; i++)
+      {
+      const uint8_t *glyph = f->glyphs + i * charsize;
+      uint32_t loc = (uint32_t)psf_hash( glyph, charsize) & hash_mask;
+
+      while( table[loc] != 0xffffffff
+                  && memcmp( unique + table[loc] * charsize, glyph, charsize))
+         loc = (loc + 1) & hash_mask;
+      if( table[loc] == 0xffffffff)
+         {
+         memcpy( unique + n_unique * charsize, glyph, charsize);
+         table[loc] = n_unique++;
+         }
+      remap[i] = table[loc];
+      }
+   free( table);
+   for( i = 0; i < f->unicode_info_size; i++)
+      if( f->unicode_info[i + i + 1] < f->n_glyphs)
+         f->unicode_info[i + i + 1] = remap[f->unicode_info[i + i + 1]];
+   for( i = 0; i < f->n_pages * 256; i++)
+      if( f->pages[i] >= 0 && (uint32_t)f->pages[i] < f->n_glyphs)
+         f->pages[i] = (int32_t)remap[f->pages[i]];
+   for( i = 0; i < f->n_seq_nodes; i++)
+      if( f->seq_nodes[i].glyph >= 0 && (uint32_t)f->seq_nodes[i].glyph < f->n_glyphs)
+         f->seq_nodes[i].glyph = (int32_t)remap[f->seq_nodes[i].glyph];
+   free( remap);
+   rval = (long)( f->n_glyphs - n_unique) * (long)charsize;
+   shrunk = (uint8_t *)realloc( unique, n_unique * charsize + 1);
+   free( f->owned_glyphs);
+   f->owned_glyphs = (shrunk ? shrunk : unique);
+   f->glyphs = f->owned_glyphs;
+   f->n_glyphs = n_unique;
+   return( rval);
+}
+
+/* High-DPI displays want glyphs drawn two or three times the font's
+size,  and rotated displays want them turned on their sides.  Doing
+that pixel by pixel while drawing is slow,  and means reading the
+font bitmaps out of order.  Instead,  get_psf_or_vgafont_variant()
+builds a scaled and/or rotated copy of all the glyphs once,  and hands
+back a font_info for it,  which can be used just like the original :
+its glyphs are stored row by row in the order they'll appear on the
+(rotated) screen.  It shares the original font's Unicode index,  so
+glyph numbers are the same in both.
+
+   'scale' can be 1 to 8.  Scaling is nearest-neighbour,  unless
+'smooth' is set and the scale is 2 or 3,  in which case the Scale2x or
+Scale3x (AdvMAME2x/3x) algorithm is used to smooth diagonals.
+'rotation' is 0,  90,  180 or 270 degrees clockwise;  rotating by 90 or
+270 swaps the glyph width and height.
+
+   The variant is kept with the original font,  so asking for it again
+costs nothing,  and it's freed along with the original.  Don't free
+it yourself.  (Nor compact the original font while using a variant;
+compaction renumbers glyphs,  so it throws the variants away.)  Because
+the original font_info is modified to remember its variants,  fonts
+shared between threads (see psf_registry.c) should have their variants
+made before they're shared,  or be given their own lock.  NULL is
+returned for bad arguments,  or if memory runs out. */
+
+static void _free_variants( struct font_info *f)
+{
+   while( f->variants)
+      {
+      struct font_info *next = f->variants->next_variant;
+
+      _free_variants( f->variants);    /* a variant can have variants,  too */
+      free( f->variants->owned_glyphs);
+      free( f->variants);
+      f->variants = next;
+      }
+}
+
+static uint8_t _get_pixel( const uint8_t *pixels, const int width,
+                        const int height, int x, int y)
+{
+   x = (x < 0 ? 0 : (x >= width ? width - 1 : x));
+   y = (y < 0 ? 0 : (y >= height ? height - 1 : y));
+   return( pixels[y * width + x]);
+}
+
+/* Scales 'src' (one byte per pixel) into 'dest'.  Scale2x/Scale3x look
+at each pixel's neighbours;  pixels beyond the edge copy the edge. */
+
+static void _scale_pixels( const uint8_t *src, const int width, const int height,
+                           uint8_t *dest, const int scale, const int smooth)
+{
+   const int dest_width = width * scale;
+   int x, y, i, j;
+
+   for( y = 0; y < height; y++)
+      for( x = 0; x < width; x++)
+         {
+         const uint8_t e = src[y * width + x];
+         uint8_t out[9];
+
+         for( i = 0; i < scale * scale && i < 9; i++)
+            out[i] = e;
+         if( smooth && (scale == 2 || scale == 3))
+            {
+            const uint8_t a = _get_pixel( src, width, height, x - 1, y - 1);
+            const uint8_t b = _get_pixel( src, width, height, x, y - 1);
+            const uint8_t c = _get_pixel( src, width, height, x + 1, y - 1);
+            const uint8_t d = _get_pixel( src, width, height, x - 1, y);
+            const uint8_t f = _get_pixel( src, width, height, x + 1, y);
+            const uint8_t g = _get_pixel( src, width, height, x - 1, y + 1);
+            const uint8_t h = _get_pixel( src, width, height, x, y + 1);
+            const uint8_t k = _get_pixel( src, width, height, x + 1, y + 1);
+
+            if( scale == 2 && b != h && d != f)
+               {
+               out[0] = (d == b ? d : e);
+               out[1] = (b == f ? f : e);
+               out[2] = (d == h ? d : e);
+               out[3] = (h == f ? f : e);
+               }
+            if( scale == 3 && b != h && d != f)
+               {
+               out[0] = (d == b ? d : e);
+               out[1] = ((d == b && e != c) || (b == f && e != a) ? b : e);
+               out[2] = (b == f ? f : e);
+               out[3] = ((d == b && e != g) || (d == h && e != a) ? d : e);
+               out[5] = ((b == f && e != k) || (h == f && e != c) ? f : e);
+               out[6] = (d == h ? d : e);
+               out[7] = ((d == h && e != k) || (h == f && e != g) ? h : e);
+               out[8] = (h == f ? f : e);
+               }
+            }
+         for( j = 0; j < scale; j++)
+            for( i = 0; i < scale; i++)
+               dest[(y * scale + j) * dest_width + x * scale + i] =
+                     (scale <= 3 ? out[j * scale + i] : e);
+         }
+}
+
+const struct font_info *get_psf_or_vgafont_variant( struct font_info *f,
+                  const int scale, const int rotation, const int smooth)
+{
+   const uint32_t key = (uint32_t)scale | ((uint32_t)rotation << 8)
+                                 | (smooth ? 0x100000 : 0);
+   const int src_width = (int)f->width, src_height = (int)f->height;
+   const int src_stride = (src_width + 7) / 8;
+   const int scaled_width = src_width * scale, scaled_height = src_height * scale;
+   const int sideways = (rotation == 90 || rotation == 270);
+   const int width = (sideways ? scaled_height : scaled_width);
+   const int height = (sideways ? scaled_width : scaled_height);
+   const int stride = (width + 7) / 8;
+   struct font_info *rval;
+   uint8_t *pixels, *scaled;
+   uint32_t glyph;
+
+   if( scale < 1 || scale > 8 || rotation % 90 || rotation < 0 || rotation > 270)
+      return( NULL);
+   if( scale == 1 && !rotation)
+      return( f);
+   for( rval = f->variants; rval; rval = rval->next_variant)
+      if( rval->variant_key == key)
+         return( rval);
+   rval = (struct font_info *)malloc( sizeof( struct font_info));
+   pixels = (uint8_t *)malloc( src_width * src_height);
+   scaled = (uint8_t *)malloc( scaled_width * scaled_height);
+   if( rval)
+      {
+      *rval = *f;
+      rval->owned_glyphs = (uint8_t *)calloc( f->n_glyphs,
+                                 (size_t)height * stride);
+      }
+   if( !rval || !pixels || !scaled || !rval->owned_glyphs)
+      {
+      if( rval)
+         free( rval->owned_glyphs);
+      free( rval);
+      free( pixels);
+      free( scaled);
+      return( NULL);
+      }
+   rval->width = (uint32_t)width;
+   rval->height = (uint32_t)height;
+   rval->charsize = (uint32_t)( height * stride);
+   rval->glyphs = rval->owned_glyphs;
+   rval->mapping = rval->index_mapping = NULL;
+   rval->variants = NULL;
+   rval->variant_key = key;
+   for( glyph = 0; glyph < f->n_glyphs; glyph++)
+      {
+      const uint8_t *src = f->glyphs + glyph * f->charsize;
+      uint8_t *dest = rval->owned_glyphs + glyph * rval->charsize;
+      int x, y;
+
+      for( y = 0; y < src_height; y++)
+         for( x = 0; x < src_width; x++)
+            pixels[y * src_width + x] =
+                  (uint8_t)( (src[y * src_stride + (x >> 3)] << (x & 7)) & 0x80);
+      _scale_pixels( pixels, src_width, src_height, scaled, scale, smooth);
+      for( y = 0; y < height; y++)
+         for( x = 0; x < width; x++)
+            {
+            int sx = x, sy = y;        /* location in the unrotated glyph */
+
+            if( rotation == 90)
+               {
+               sx = y;
+               sy = scaled_height - 1 - x;
+               }
+            else if( rotation == 180)
+               {
+               sx = scaled_width - 1 - x;
+               sy = scaled_height - 1 - y;
+               }
+            else if( rotation == 270)
+               {
+               sx = scaled_width - 1 - y;
+               sy = x;
+               }
+            if( scaled[sy * scaled_width + sx])
+               dest[y * stride + (x >> 3)] |= (uint8_t)( 0x80 >> (x & 7));
+            }
+      }
+   free( pixels);
+   free( scaled);
+   rval->next_variant = f->variants;
+   f->variants = rval;
+   return( rval);
+}
+
+/* write_psf2_font() writes a font out in PSF2 form,  Unicode table
+and all.  If 'keep' is non-NULL,  only glyphs for which keep[glyph_num]
+is non-zero are written,  renumbered in order;  the Unicode table is
+rebuilt to match,  with any points or sequences that led to dropped
+glyphs left out.  A font with no Unicode table (vgafont,  or a PSF
+without one) is looked up by glyph number,  so when it's subsetted,
+it's given a table mapping each old glyph number to its new one,  and
+lookups through find_psf_or_vgafont_glyph() give the same bitmaps as
+before.  PSF2 fields are written little-endian,  whatever the host.
+Returns 0 on success,  -1 if memory ran out,  -2 on a write error. */
+
+static void _put32( uint8_t *buff, const uint32_t ival)
+{
+   buff[0] = (uint8_t)ival;
+   buff[1] = (uint8_t)( ival >> 8);
+   buff[2] = (uint8_t)( ival >> 16);
+   buff[3] = (uint8_t)( ival >> 24);
+}
+
+static size_t _encode_utf8( uint8_t *buff, const uint32_t point)
+{
+   if( point < 0x80)
+      {
+      buff[0] = (uint8_t)point;
+      return( 1);
+      }
+   if( point < 0x800)
+      {
+      buff[0] = (uint8_t)( 0xc0 | (point >> 6));
+      buff[1] = (uint8_t)( 0x80 | (point & 0x3f));
+      return( 2);
+      }
+   if( point < 0x10000)
+      {
+      buff[0] = (uint8_t)( 0xe0 | (point >> 12));
+      buff[1] = (uint8_t)( 0x80 | ((point >> 6) & 0x3f));
+      buff[2] = (uint8_t)( 0x80 | (point & 0x3f));
+      return( 3);
+      }
+   buff[0] = (uint8_t)( 0xf0 | ((point >> 18) & 0x07));
+   buff[1] = (uint8_t)( 0x80 | ((point >> 12) & 0x3f));
+   buff[2] = (uint8_t)( 0x80 | ((point >> 6) & 0x3f));
+   buff[3] = (uint8_t)( 0x80 | (point & 0x3f));
+   return( 4);
+}
+
+   /* Returns 0 if the point was written,  -2 if the write failed. */
+
+static int _put_utf8( FILE *ofile, const uint32_t point)
+{
+   uint8_t buff[4];
+   const size_t n_bytes = _encode_utf8( buff, point);
+
+   return( fwrite( buff, n_bytes, 1, ofile) == 1 ? 0 : -2);
+}
+
+   /* Walks the sequence trie depth-first,  recording each sequence
+   that leads to a glyph we're keeping as a [glyph, length, points...]
+   record,  just as the loaders do. */
+
+static void _gather_sequences( const struct font_info *f, const uint32_t node,
+            uint32_t *path, const uint32_t depth, const int32_t *new_num,
+            struct seq_buffer *seqs)
+{
+   const struct psf_seq_node *nptr = f->seq_nodes + node;
+   uint32_t i;
+
+   if( depth && nptr->glyph >= 0 && (uint32_t)nptr->glyph < f->n_glyphs
+                  && new_num[nptr->glyph] >= 0)
+      {
+      _start_sequence( seqs, (uint32_t)new_num[nptr->glyph]);
+      for( i = 0; i < depth; i++)
+         _add_to_sequence( seqs, path[i]);
+      _end_sequence( seqs);
+      }
+   for( i = 0; i < nptr->n_children; i++)
+      {
+      path[depth] = f->seq_nodes[nptr->first_child + i].unicode_point;
+      _gather_sequences( f, nptr->first_child + i, path, depth + 1, new_num, seqs);
+      }
+}
+
+static int _compare_sequence_glyphs( const void *a, const void *b)
+{
+   const uint32_t *seq_a = *(const uint32_t * const *)a;
+   const uint32_t *seq_b = *(const uint32_t * const *)b;
+
+   return( (seq_a[0] > seq_b[0]) - (seq_a[0] < seq_b[0]));
+}
+
+int write_psf2_font( const struct font_info *f, FILE *ofile, const char *keep)
+{
+   const int identity_table = (!f->unicode_info && keep);
+   uint32_t i, j, n_out = 0, n_seqs = 0, n_singles = 0;
+   int32_t *new_num = (int32_t *)malloc( (f->n_glyphs + 1) * sizeof( int32_t));
+   uint32_t *offsets = NULL, *singles = NULL, *path = NULL;
+   const uint32_t **sorted = NULL;
+   struct seq_buffer seqs;
+   uint8_t hdr[32];
+   int rval = 0;
+
+   memset( &seqs, 0, sizeof( seqs));
+   if( !new_num)
+      return( -1);
+   for( i = 0; i < f->n_glyphs; i++)
+      new_num[i] = ((!keep || keep[i]) ? (int32_t)n_out++ : -1);
+            /* Gather the single points by (new) glyph number,  with a
+            counting sort,  so they come out in table order... */
+   offsets = (uint32_t *)calloc( n_out + 1, sizeof( uint32_t));
+   singles = (uint32_t *)malloc( (f->unicode_info_size + 1) * sizeof( uint32_t));
+   if( !offsets || !singles)
+      rval = -1;
+   for( i = 0; !rval && i < f->unicode_info_size; i++)
+      {
+      const uint32_t glyph = f->unicode_info[i + i + 1];
+
+      if( glyph < f->n_glyphs && new_num[glyph] >= 0)
+         {
+         offsets[new_num[glyph] + 1]++;
+         n_singles++;
+         }
+      }
+   for( i = 0; !rval && i < n_out; i++)
+      offsets[i + 1] += offsets[i];
+   for( i = 0; !rval && i < f->unicode_info_size; i++)
+      {
+      const uint32_t glyph = f->unicode_info[i + i + 1];
+
+      if( glyph < f->n_glyphs && new_num[glyph] >= 0)
+         singles[offsets[new_num[glyph]]++] = f->unicode_info[i + i];
+      }
+   for( i = n_out; !rval && i; i--)       /* undo the increments above */
+      offsets[i] = offsets[i - 1];
+   if( !rval)
+      offsets[0] = 0;
+            /* ...and the sequences likewise,  via a walk of the trie */
+   if( !rval && f->n_seq_nodes)
+      {
+      path = (uint32_t *)malloc( f->n_seq_nodes * sizeof( uint32_t));
+      if( !path)
+         rval = -1;
+      else
+         _gather_sequences( f, 0, path, 0, new_num, &seqs);
+      _end_sequence( &seqs);
+      }
+   if( !rval && seqs.n_sequences)
+      {
+      sorted = (const uint32_t **)malloc( seqs.n_sequences * sizeof( uint32_t *));
+      if( !sorted)
+         rval = -1;
+      else
+         {
+         for( i = 0; i < seqs.n_used; i += seqs.data[i + 1] + 2)
+            sorted[n_seqs++] = seqs.data + i;
+         qsort( sorted, n_seqs, sizeof( uint32_t *), _compare_sequence_glyphs);
+         }
+      }
+   if( !rval)
+      {
+      const int has_table = (n_singles || n_seqs || identity_table);
+
+      hdr[0] = PSF2_MAGIC0;
+      hdr[1] = PSF2_MAGIC1;
+      hdr[2] = PSF2_MAGIC2;
+      hdr[3] = PSF2_MAGIC3;
+      _put32( hdr + 4, 0);                /* version */
+      _put32( hdr + 8, sizeof( hdr));     /* header size */
+      _put32( hdr + 12, has_table ? PSF2_HAS_UNICODE_TABLE : 0);
+      _put32( hdr + 16, n_out);
+      _put32( hdr + 20, f->charsize);
+      _put32( hdr + 24, f->height);
+      _put32( hdr + 28, f->width);
+      if( fwrite( hdr, sizeof( hdr), 1, ofile) != 1)
+         rval = -2;
+      for( i = 0; !rval && i < f->n_glyphs; i++)
+         if( new_num[i] >= 0 && f->charsize)
+            if( fwrite( f->glyphs + i * f->charsize, f->charsize, 1, ofile) != 1)
+               rval = -2;
+      for( i = j = 0; !rval && has_table && i < f->n_glyphs; i++)
+         if( new_num[i] >= 0)
+            {
+            const uint32_t glyph = (uint32_t)new_num[i];
+            uint32_t k;
+
+            for( k = offsets[glyph]; !rval && k < offsets[glyph + 1]; k++)
+               rval = _put_utf8( ofile, singles[k]);
+            if( !rval && identity_table)
+               rval = _put_utf8( ofile, i);
+            for( ; !rval && j < n_seqs && sorted[j][0] == glyph; j++)
+               {
+               if( fputc( PSF2_STARTSEQ, ofile) == EOF)
+                  rval = -2;
+               for( k = 0; !rval && k < sorted[j][1]; k++)
+                  rval = _put_utf8( ofile, sorted[j][k + 2]);
+               }
+            if( !rval && fputc( PSF2_SEPARATOR, ofile) == EOF)
+               rval = -2;
+            }
+      }
+   free( new_num);
+   free( offsets);
+   free( singles);
+   free( path);
+   free( sorted);
+   free( seqs.data);
+   return( rval);
+}
+
+/* PSF2 fonts can't mix glyph widths,  so a terminal showing both
+Latin and CJK text (say) will want an 8x16 font plus a 16x16 one for
+everything the first lacks.  A 'font set' is an ordered list of fonts,
+plus a merged index in the same two-level form as each font's :  each
+code point leads to a (font, glyph) pair,  packed into an int32_t as
+(font number << 24) | glyph number,  or -1 if no font in the set has
+the point.  The first font with a glyph for a point wins.  That's all
+sorted out when the set is built,  so a lookup costs the same as one in
+a single font,  no matter how many fonts are in the set.
+
+   The fonts aren't copied,  and must outlast the set.  Up to 127 fonts
+(PSF_SET_MAX_FONTS) can be used,  each with up to 2^24 glyphs.  Multi-
+point sequences aren't merged;  use find_psf_or_vgafont_sequence() on
+the font a sequence's first point resolves to.  Returns 0 on success,
+-1 if out of memory or given too many fonts. */
+
+static int32_t _font_glyph_on_page( const struct font_info *f, const uint32_t page,
+                                    const uint32_t offset)
+{
+   const uint32_t unicode_point = (page << 8) | offset;
+
+   if( !f->pages)
+      return( unicode_point < f->n_glyphs ? (int32_t)unicode_point : -1);
+   return( f->pages[f->page_index[page] * 256 + offset]);
+}
+
+int build_psf_font_set( struct psf_font_set *set, const struct font_info **fonts,
+                                    const size_t n_fonts)
+{
+   uint32_t i, page, n_pages = 2;      /* empty page + Latin-1 page */
+   size_t font_num;
+
+   memset( set, 0, sizeof( struct psf_font_set));
+   if( n_fonts > PSF_SET_MAX_FONTS)
+      return( -1);
+   set->page_index = (uint16_t *)calloc( N_TOP_LEVEL_ENTRIES, sizeof( uint16_t));
+   set->fonts = (const struct font_info **)malloc(
+                           (n_fonts + 1) * sizeof( struct font_info *));
+   if( !set->page_index || !set->fonts)
+      {
+      free_psf_font_set( set);
+      return( -1);
+      }
+   memcpy( set->fonts, fonts, n_fonts * sizeof( struct font_info *));
+   set->n_fonts = (uint32_t)n_fonts;
+   set->page_index[0] = 1;
+   for( font_num = 0; font_num < n_fonts; font_num++)
+      {
+      const struct font_info *f = fonts[font_num];
+
+      for( page = 0; page < N_TOP_LEVEL_ENTRIES; page++)
+         if( !set->page_index[page]
+               && (f->pages ? f->page_index[page] != 0 : (page << 8) < f->n_glyphs))
+            set->page_index[page] = (uint16_t)n_pages++;
+      }
+   set->pages = (int32_t *)malloc( n_pages * 256 * sizeof( int32_t));
+   if( !set->pages)
+      {
+      free_psf_font_set( set);
+      return( -1);
+      }
+   memset( set->pages, 0xff, n_pages * 256 * sizeof( int32_t));
+   set->n_pages = n_pages;
+   for( page = 0; page < N_TOP_LEVEL_ENTRIES; page++)
+      if( set->page_index[page])
+         {
+         int32_t *tptr = set->pages + set->page_index[page] * 256;
+
+         for( font_num = n_fonts; font_num--; )    /* last font first, */
+            for( i = 0; i < 256; i++)             /* so earlier ones win */
+               {
+               const int32_t glyph = _font_glyph_on_page( fonts[font_num], page, i);
+
+               if( glyph >= 0 && glyph < 0x1000000)
+                  tptr[i] = (int32_t)( font_num << 24) | glyph;
+               }
+         }
+   return( 0);
+}
+
+int find_psf_font_set_glyph( const struct psf_font_set *set,
+            const uint32_t unicode_point, const struct font_info **font)
+{
+   int32_t rval = -1;
+
+   if( unicode_point < 256)           /* ASCII/Latin-1 fast path */
+      rval = set->pages[256 + unicode_point];
+   else if( unicode_point <= MAX_UNICODE_POINT)
+      rval = set->pages[set->page_index[unicode_point >> 8] * 256
+                                    + (unicode_point & 0xff)];
+   if( rval < 0)
+      {
+      *font = NULL;
+      return( -1);
+      }
+   *font = set->fonts[rval >> 24];
+   return( (int)( rval & 0xffffff));
+}
+
+void free_psf_font_set( struct psf_font_set *set)
+{
+   free( set->fonts);
+   free( set->page_index);
+   free( set->pages);
+   memset( set, 0, sizeof( struct psf_font_set));
+}
@@ -1,3 +1,37 @@
+/* PSF1 and PSF2 header constants;  shared by psf.c and psf_gz.c */
+
+#define PSF1_MAGIC0     0x36
+#define PSF1_MAGIC1     0x04
+
+#define PSF1_MODE512    0x01
+#define PSF1_MODEHASTAB 0x02
+#define PSF1_MODEHASSEQ 0x04
+#define PSF1_MAXMODE    0x05
+
+#define PSF1_SEPARATOR  0xFFFF
+#define PSF1_STARTSEQ   0xFFFE
+
+#define PSF2_MAGIC0     0x72
+#define PSF2_MAGIC1     0xb5
+#define PSF2_MAGIC2     0x4a
+#define PSF2_MAGIC3     0x86
+
+/* bits used in flags */
+#define PSF2_HAS_UNICODE_TABLE 0x01
+
+/* max version recognized so far */
+#define PSF2_MAXVERSION 0
+
+/* UTF8 separators */
+#define PSF2_SEPARATOR  0xFF
+#define PSF2_STARTSEQ   0xFE
+
+struct psf_seq_node {           /* see psf.c for details */
+        uint32_t unicode_point;
+        int32_t glyph;          /* -1 if no sequence ends here */
+        uint32_t first_child, n_children;
+};
+
 struct font_info {
         uint32_t font_type;
         uint32_t headersize;    /* offset of bitmaps in file */
@@ -7,7 +41,55 @@ struct font_info {
         uint32_t *unicode_info;
         uint32_t unicode_info_size;
         const uint8_t *glyphs;
+        uint32_t unicode_table_offset;    /* zero if there's no table */
+        uint16_t *page_index;   /* (Unicode point >> 8) -> page in 'pages' */
+        int32_t *pages;         /* 256 glyph numbers per page;  -1 = none */
+        uint32_t n_pages;
+        struct psf_seq_node *seq_nodes;   /* trie of multi-point sequences */
+        uint32_t n_seq_nodes;
+        uint32_t seq_filter[128];         /* set if a sequence may start */
+        void *mapping;          /* set by open_psf_or_vgafont() */
+        size_t mapping_len;
+        void *index_mapping;    /* Unicode index from the cache,  if any */
+        size_t index_mapping_len;
+        uint8_t *owned_glyphs;  /* allocated glyphs,  freed with the font */
+        struct font_info *variants;  /* scaled/rotated copies;  see psf.c */
+        struct font_info *next_variant;   /* next copy of the same font */
+        uint32_t variant_key;
+};
+
+#define PSF_SET_MAX_FONTS 127
+
+struct psf_font_set {           /* see psf.c for details */
+        const struct font_info **fonts;
+        uint32_t n_fonts;
+        uint16_t *page_index;   /* (Unicode point >> 8) -> page in 'pages' */
+        int32_t *pages;         /* (font << 24) | glyph;  -1 = none */
+        uint32_t n_pages;
 };
 
 int load_psf_or_vgafont( struct font_info *f, const uint8_t *buff, const long filelen);
-int find_psf_or_vgafont_glyph( struct font_info *f, const uint32_t unicode_point);
+int find_psf_or_vgafont_glyph( const struct font_info *f, const uint32_t unicode_point);
+int find_psf_or_vgafont_sequence( const struct font_info *f, const uint32_t *text,
+                                 const size_t len, size_t *n_used);
+void free_psf_or_vgafont( struct font_info *f);
+int open_psf_or_vgafont( struct font_info *f, const char *filename);
+void close_psf_or_vgafont( struct font_info *f);
+uint32_t psf_decode_utf8( const char *utf8, const size_t len, size_t *n_bytes);
+size_t psf_utf8_to_glyphs( const struct font_info *f, const char *utf8,
+                                 const size_t len, int32_t *glyphs);
+size_t psf_utf32_to_glyphs( const struct font_info *f, const uint32_t *text,
+                                 const size_t len, int32_t *glyphs);
+long compact_psf_or_vgafont( struct font_info *f);
+const struct font_info *get_psf_or_vgafont_variant( struct font_info *f,
+                  const int scale, const int rotation, const int smooth);
+int write_psf2_font( const struct font_info *f, FILE *ofile, const char *keep);
+int build_psf_font_set( struct psf_font_set *set, const struct font_info **fonts,
+                                    const size_t n_fonts);
+int find_psf_font_set_glyph( const struct psf_font_set *set,
+            const uint32_t unicode_point, const struct font_info **font);
+void free_psf_font_set( struct psf_font_set *set);
+uint64_t psf_hash( const void *data, size_t len);
+int psf_cache_filename( char *filename, const size_t max_len,
+                  const char *env_var, const char *subdir,
+                  const uint64_t hash, const char *extension);
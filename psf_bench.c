@@ -0,0 +1,592 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include "psf.h"
+#include "psf_cache.h"
+#include "fbcon.h"
+
+/* Throughput and latency benchmarks for psf.c (and psf_cache.c).  Run as
+
+./psf_bench (options) (font files)
+
+   Each font file given is benchmarked.  Fonts can also be synthesised,
+so that results don't depend on what fonts happen to be installed :
+
+   -t type      Make a font of this type : psf1,  psf2 or vga.  Can be
+                given more than once.  If no fonts or types are given,
+                all three are made.
+   -g n         Number of glyphs in synthesised PSF2 fonts (default
+                65536).  PSF1 fonts get 512 glyphs if n > 256,  else 256.
+                vgafonts always have 256.
+   -d density   Number of Unicode table entries per glyph (default 1.0;
+                values below 1 leave some glyphs unmapped,  above 1
+                map several points to some glyphs).  vgafonts have no
+                table.
+   -n n         Number of lookups per stream (default 1000000).
+   -s seed      Random number seed (default 1).
+
+   Synthesised fonts map points in the order ASCII,  Latin-1,  Greek
+and Cyrillic,  CJK (U+4E00 on),  Hangul,  then emoji (U+1F300 on).
+Glyph bitmaps are random,  except that every eighth is blank,  so that
+compaction has duplicates to find.
+
+   For each font,  we time loading it from memory and three streams of
+lookups :  'random' (points picked at random from the font's Unicode
+table),  'ascii' (90% printable ASCII) and 'cjk' (90% U+4E00 to U+9FFF).
+Each stream is looked up with the index,  with a binary search of the
+sorted table (what psf.c used to do),  and as UTF-8 both one character
+at a time and with psf_utf8_to_glyphs().  The random stream is drawn
+into a 32-bit-per-pixel buffer,  both pixel by pixel and through a
+256-KByte glyph cache.  A text console (fbcon.c) filling 1920x1080
+and 3840x2160 32-bit buffers is redrawn with every cell changed on
+each frame,  giving frames per second;  the result is checked against
+a console drawn from scratch.  Finally,  the font is compacted,  and
+we check that the first 256 points still get the same bitmaps.
+
+   Output is one line per measurement,  tab-separated :  font name,
+metric,  value.  That's easy to diff between releases,  or to feed to
+a spreadsheet.  Rates are in millions per second;  times in
+milliseconds or nanoseconds,  as the metric name says.  Any
+disagreement between methods is reported on stderr.  */
+
+static int _compare_unicode_info( const void *a, const void *b)
+{
+   const uint32_t a0 = *(const uint32_t *)a;
+   const uint32_t b0 = *(const uint32_t *)b;
+
+   return( (a0 > b0) - (a0 < b0));
+}
+
+static int bsearch_glyph( const struct font_info *f, const uint32_t unicode_point)
+{
+   const uint32_t *tptr = (const uint32_t *)bsearch( &unicode_point,
+               f->unicode_info, f->unicode_info_size,
+               2 * sizeof( uint32_t), _compare_unicode_info);
+
+   return( tptr ? (int)tptr[1] : -1);
+}
+
+static size_t encode_utf8( uint8_t *dest, const uint32_t code)
+{
+   if( code < 0x80)
+      {
+      dest[0] = (uint8_t)code;
+      return( 1);
+      }
+   if( code < 0x800)
+      {
+      dest[0] = (uint8_t)( 0xc0 | (code >> 6));
+      dest[1] = (uint8_t)( 0x80 | (code & 0x3f));
+      return( 2);
+      }
+   if( code < 0x10000)
+      {
+      dest[0] = (uint8_t)( 0xe0 | (code >> 12));
+      dest[1] = (uint8_t)( 0x80 | ((code >> 6) & 0x3f));
+      dest[2] = (uint8_t)( 0x80 | (code & 0x3f));
+      return( 3);
+      }
+   dest[0] = (uint8_t)( 0xf0 | (code >> 18));
+   dest[1] = (uint8_t)( 0x80 | ((code >> 12) & 0x3f));
+   dest[2] = (uint8_t)( 0x80 | ((code >> 6) & 0x3f));
+   dest[3] = (uint8_t)( 0x80 | (code & 0x3f));
+   return( 4);
+}
+
+static uint32_t decode_utf8( const uint8_t **text)
+{
+   const uint8_t *tptr = *text;
+   uint32_t rval;
+
+   if( *tptr < 0x80)
+      rval = *tptr++;
+   else if( *tptr < 0xe0)
+      {
+      rval = ((tptr[0] & 0x1f) << 6) | (tptr[1] & 0x3f);
+      tptr += 2;
+      }
+   else if( *tptr < 0xf0)
+      {
+      rval = ((tptr[0] & 0x0f) << 12) | ((tptr[1] & 0x3f) << 6) | (tptr[2] & 0x3f);
+      tptr += 3;
+      }
+   else
+      {
+      rval = ((uint32_t)( tptr[0] & 0x07) << 18) | ((tptr[1] & 0x3f) << 12)
+                  | ((tptr[2] & 0x3f) << 6) | (tptr[3] & 0x3f);
+      tptr += 4;
+      }
+   *text = tptr;
+   return( rval);
+}
+
+static void draw_glyph_directly( const struct font_info *f, const int glyph_num,
+               uint32_t *dest, const size_t dest_stride)
+{
+   const uint32_t stride = (f->width + 7) / 8;
+   const uint8_t *src = f->glyphs + (size_t)glyph_num * f->charsize;
+   uint32_t x, y;
+
+   for( y = 0; y < f->height; y++, src += stride, dest += dest_stride)
+      for( x = 0; x < f->width; x++)
+         dest[x] = (((src[x >> 3] << (x & 7)) & 0x80) ? 0xffffff : 0);
+}
+
+static double seconds_since( const clock_t t0)
+{
+   return( (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC);
+}
+
+static const char *font_name;
+
+static void report( const char *metric, const double value)
+{
+   printf( "%s\t%s\t%.6g\n", font_name, metric, value);
+}
+
+static void report2( const char *prefix, const char *metric, const double value)
+{
+   char buff[100];
+
+   snprintf( buff, sizeof( buff), "%s.%s", prefix, metric);
+   report( buff, value);
+}
+
+   /* The k-th Unicode point a synthesised font maps;  see above. */
+
+static uint32_t nth_unicode_point( uint32_t k)
+{
+   static const uint32_t ranges[] = { 0x20, 0x7e, 0xa0, 0x24f,
+            0x370, 0x52f, 0x4e00, 0x9fff, 0xac00, 0xd7a3, 0x1f300, 0x10ffff };
+   size_t i;
+
+   for( i = 0; i < sizeof( ranges) / sizeof( ranges[0]); i += 2)
+      if( k <= ranges[i + 1] - ranges[i])
+         return( ranges[i] + k);
+      else
+         k -= ranges[i + 1] - ranges[i] + 1;
+   return( 0x10ffff);
+}
+
+static size_t put_le( uint8_t *dest, uint32_t value, size_t n_bytes)
+{
+   size_t i;
+
+   for( i = 0; i < n_bytes; i++, value >>= 8)
+      dest[i] = (uint8_t)value;
+   return( n_bytes);
+}
+
+/* Makes a font of the given type in memory.  Glyph 'g' gets the
+Unicode points k for which k % n_glyphs == g,  for k up to
+density * n_glyphs,  so the table is in order if density <= 1 and
+mostly out of order otherwise (which exercises the sort). */
+
+static uint8_t *make_font( const char *type, uint32_t *glyph_count,
+                           const double density, long *len)
+{
+   uint32_t n_glyphs = *glyph_count;
+   const uint32_t height = 16, charsize = 16;
+   const int is_psf1 = !strcmp( type, "psf1");
+   const int is_psf2 = !strcmp( type, "psf2");
+   uint32_t i, k, n_entries, headersize;
+   size_t loc, max_len;
+   uint8_t *buff;
+
+   if( is_psf1)
+      {
+      n_glyphs = (n_glyphs > 256 ? 512 : 256);
+      headersize = 4;
+      }
+   else if( is_psf2)
+      headersize = 32;
+   else if( !strcmp( type, "vga"))
+      {
+      n_glyphs = 256;
+      headersize = 0;
+      }
+   else
+      return( NULL);
+   n_entries = (uint32_t)( density * (double)n_glyphs + .5);
+   if( is_psf1)        /* PSF1 only handles the BMP */
+      while( n_entries && nth_unicode_point( n_entries - 1) > 0xffff)
+         n_entries--;
+   max_len = headersize + (size_t)n_glyphs * charsize + n_glyphs * 2
+                        + (size_t)n_entries * 4;
+   buff = (uint8_t *)calloc( max_len, 1);
+   assert( buff);
+   if( is_psf1)
+      {
+      buff[0] = 0x36;
+      buff[1] = 0x04;
+      buff[2] = (uint8_t)( (n_glyphs == 512 ? 1 : 0) | (n_entries ? 2 : 0));
+      buff[3] = (uint8_t)charsize;
+      }
+   if( is_psf2)
+      {
+      buff[0] = 0x72;
+      buff[1] = 0xb5;
+      buff[2] = 0x4a;
+      buff[3] = 0x86;
+      put_le( buff + 8, headersize, 4);
+      put_le( buff + 12, (n_entries ? 1 : 0), 4);
+      put_le( buff + 16, n_glyphs, 4);
+      put_le( buff + 20, charsize, 4);
+      put_le( buff + 24, height, 4);
+      put_le( buff + 28, 8, 4);
+      }
+   loc = headersize;
+   for( i = 0; i < n_glyphs; i++)
+      for( k = 0; k < charsize; k++)
+         buff[loc++] = (uint8_t)( i % 8 ? rand( ) : 0);
+   if( n_entries && headersize)
+      for( i = 0; i < n_glyphs; i++)
+         {
+         for( k = i; k < n_entries; k += n_glyphs)
+            if( is_psf1)
+               loc += put_le( buff + loc, nth_unicode_point( k), 2);
+            else
+               loc += encode_utf8( buff + loc, nth_unicode_point( k));
+         if( is_psf1)
+            loc += put_le( buff + loc, 0xffff, 2);
+         else
+            buff[loc++] = 0xff;
+         }
+   *len = (long)loc;
+   *glyph_count = n_glyphs;
+   return( buff);
+}
+
+static void make_stream( const struct font_info *f, const char *stream_type,
+                     uint32_t *points, const long n)
+{
+   long i;
+
+   for( i = 0; i < n; i++)
+      {
+      const int r = rand( );
+
+      if( !strcmp( stream_type, "ascii") && r % 10)
+         points[i] = (uint32_t)( ' ' + rand( ) % 95);
+      else if( !strcmp( stream_type, "cjk") && r % 10)
+         points[i] = (uint32_t)( 0x4e00 + rand( ) % 0x5200);
+      else if( !strcmp( stream_type, "cjk"))
+         points[i] = (uint32_t)( ' ' + rand( ) % 95);
+      else if( f->unicode_info_size)
+         points[i] = f->unicode_info[2 * (rand( ) % f->unicode_info_size)];
+      else
+         points[i] = (uint32_t)( rand( ) % f->n_glyphs);
+      }
+}
+
+static void bench_stream( struct font_info *f, const char *stream_type,
+                           const long n_lookups)
+{
+   uint32_t *points = (uint32_t *)malloc( n_lookups * sizeof( uint32_t));
+   uint8_t *utf8 = (uint8_t *)malloc( n_lookups * 4);
+   int32_t *glyphs = (int32_t *)malloc( n_lookups * 4 * sizeof( int32_t));
+   long i, sum_index = 0, sum_bsearch = 0, sum_per_char = 0, sum_batch = 0;
+   const double millions = (double)n_lookups * 1e-6;
+   size_t utf8_len = 0, n_found;
+   clock_t t0;
+
+   assert( points && utf8 && glyphs);
+   make_stream( f, stream_type, points, n_lookups);
+   t0 = clock( );
+   for( i = 0; i < n_lookups; i++)
+      sum_index += find_psf_or_vgafont_glyph( f, points[i]);
+   report2( stream_type, "index_M_per_s", millions / seconds_since( t0));
+   if( f->unicode_info)
+      {
+      t0 = clock( );
+      for( i = 0; i < n_lookups; i++)
+         sum_bsearch += bsearch_glyph( f, points[i]);
+      report2( stream_type, "bsearch_M_per_s", millions / seconds_since( t0));
+      if( sum_bsearch != sum_index)
+         fprintf( stderr, "%s %s: MISMATCH: index/bsearch checksums %ld, %ld\n",
+                     font_name, stream_type, sum_index, sum_bsearch);
+      }
+
+   for( i = 0; i < n_lookups; i++)
+      utf8_len += encode_utf8( utf8 + utf8_len, points[i]);
+   t0 = clock( );
+   {
+   const uint8_t *tptr = utf8, *end = utf8 + utf8_len;
+
+   n_found = 0;
+   while( tptr < end)
+      glyphs[n_found++] = find_psf_or_vgafont_glyph( f, decode_utf8( &tptr));
+   }
+   report2( stream_type, "utf8_per_char_M_per_s", millions / seconds_since( t0));
+   for( i = 0; i < (long)n_found; i++)
+      sum_per_char += glyphs[i];
+   t0 = clock( );
+   n_found = psf_utf8_to_glyphs( f, (const char *)utf8, utf8_len, glyphs);
+   report2( stream_type, "utf8_batch_M_per_s", millions / seconds_since( t0));
+   for( i = 0; i < (long)n_found; i++)
+      sum_batch += glyphs[i];
+   if( sum_per_char != sum_batch || sum_batch != sum_index)
+      fprintf( stderr, "%s %s: MISMATCH: UTF-8 checksums %ld, %ld, %ld\n",
+               font_name, stream_type, sum_per_char, sum_batch, sum_index);
+
+   if( !strcmp( stream_type, "random"))
+      {
+      const size_t row_len = 80 * f->width;
+      const long n_draws = (n_found < 1000000 ? (long)n_found : 1000000);
+      uint32_t *image = (uint32_t *)calloc( row_len * f->height, sizeof( uint32_t));
+      struct glyph_cache *cache = create_glyph_cache( f, 4, 0xffffff, 0,
+                                                   256 * 1024);
+      unsigned long n_hits, n_misses;
+
+      assert( image && cache);
+      t0 = clock( );
+      for( i = 0; i < n_draws; i++)
+         if( glyphs[i] >= 0)
+            draw_glyph_directly( f, glyphs[i], image + (i % 80) * f->width, row_len);
+      report( "draw_direct_ns_per_glyph", seconds_since( t0) * 1e+9 / (double)n_draws);
+      t0 = clock( );
+      for( i = 0; i < n_draws; i++)
+         draw_cached_glyph( cache, glyphs[i], (uint8_t *)( image + (i % 80) * f->width),
+                              row_len * sizeof( uint32_t));
+      report( "draw_cached_ns_per_glyph", seconds_since( t0) * 1e+9 / (double)n_draws);
+      get_glyph_cache_stats( cache, &n_hits, &n_misses);
+      report( "draw_cache_hit_rate", (double)n_hits / (double)( n_hits + n_misses));
+      free_glyph_cache( cache);
+      free( image);
+      }
+   free( points);
+   free( utf8);
+   free( glyphs);
+}
+
+   /* Each frame puts a different ASCII character,  and different
+colours,  in every cell,  so every cell is redrawn.  The last frame is
+then drawn by a fresh console,  into a second buffer,  to check that
+damage tracking didn't miss anything.  */
+
+static void bench_fbcon( const struct font_info *f, const uint32_t xres,
+                         const uint32_t yres, const char *prefix)
+{
+   const size_t line_length = (size_t)xres * 4;
+   uint8_t *screen = (uint8_t *)calloc( line_length, yres);
+   uint8_t *check = (uint8_t *)calloc( line_length, yres);
+   uint32_t palette[16], n_cols, n_rows, row, col;
+   struct fbcon *con, *con2;
+   int n_frames = 0, i;
+   double elapsed;
+   size_t n_bytes = 0;
+   clock_t t0;
+
+   for( i = 0; i < 16; i++)
+      palette[i] = (i & 8 ? 0x555555 : 0) + (i & 4 ? 0xaa0000 : 0)
+                 + (i & 2 ? 0xaa00 : 0) + (i & 1 ? 0xaa : 0);
+   con = create_fbcon( f, screen, xres, yres, line_length, 4, palette, 256 * 1024);
+   con2 = create_fbcon( f, check, xres, yres, line_length, 4, palette, 256 * 1024);
+   if( !screen || !check || !con || !con2)
+      {
+      fprintf( stderr, "%s: couldn't make %ux%u console\n", font_name,
+                                 (unsigned)xres, (unsigned)yres);
+      free_fbcon( con);
+      free_fbcon( con2);
+      free( screen);
+      free( check);
+      return;
+      }
+   get_fbcon_size( con, &n_cols, &n_rows);
+   fbcon_flush( con);
+   t0 = clock( );
+   do
+      {
+      n_frames++;
+      for( row = 0; row < n_rows; row++)
+         for( col = 0; col < n_cols; col++)
+            fbcon_put( con, col, row, ' ' + (row + col + n_frames) % 95,
+                     (n_frames + row) % 7 + 1, n_frames & 1, 0);
+      n_bytes += fbcon_flush( con);
+      elapsed = seconds_since( t0);
+      }
+      while( elapsed < .5 && n_frames < 1000);
+   report2( prefix, "fbcon_frames_per_sec", (double)n_frames / elapsed);
+   report2( prefix, "fbcon_bytes_per_frame", (double)n_bytes / (double)n_frames);
+   for( row = 0; row < n_rows; row++)
+      for( col = 0; col < n_cols; col++)
+         fbcon_put( con2, col, row, ' ' + (row + col + n_frames) % 95,
+                     (n_frames + row) % 7 + 1, n_frames & 1, 0);
+   fbcon_flush( con2);
+   if( memcmp( screen, check, line_length * yres))
+      fprintf( stderr, "%s %s: MISMATCH between console updates and redraw\n",
+                                 font_name, prefix);
+   free_fbcon( con);
+   free_fbcon( con2);
+   free( screen);
+   free( check);
+}
+
+static size_t index_bytes( const struct font_info *f)
+{
+   size_t rval = f->unicode_info_size * 2 * sizeof( uint32_t)
+                  + f->n_seq_nodes * sizeof( struct psf_seq_node);
+
+   if( f->pages)
+      rval += f->n_pages * 256 * sizeof( int32_t)
+                  + ((0x10ffff >> 8) + 1) * sizeof( uint16_t);
+   return( rval);
+}
+
+static void bench_font( const uint8_t *buff, const long len, const long n_lookups)
+{
+   struct font_info f;
+   int n_loads = 0;
+   double elapsed;
+   long saved;
+   uint8_t *before;
+   int32_t glyphs[256];
+   uint32_t i;
+   const clock_t t0 = clock( );
+
+   do
+      {
+      if( load_psf_or_vgafont( &f, buff, len))
+         {
+         fprintf( stderr, "%s: not a PSF1/PSF2/vgafont font\n", font_name);
+         return;
+         }
+      free_psf_or_vgafont( &f);
+      n_loads++;
+      elapsed = seconds_since( t0);
+      }
+      while( elapsed < .2 && n_loads < 1000);
+   report( "load_ms", elapsed * 1000. / (double)n_loads);
+   load_psf_or_vgafont( &f, buff, len);
+   report( "n_glyphs", (double)f.n_glyphs);
+   report( "n_unicode_entries", (double)f.unicode_info_size);
+   report( "file_bytes", (double)len);
+   report( "glyph_bytes", (double)f.n_glyphs * (double)f.charsize);
+   report( "index_bytes", (double)index_bytes( &f));
+   bench_stream( &f, "random", n_lookups);
+   bench_stream( &f, "ascii", n_lookups);
+   bench_stream( &f, "cjk", n_lookups);
+   bench_fbcon( &f, 1920, 1080, "1080p");
+   bench_fbcon( &f, 3840, 2160, "4k");
+   before = (uint8_t *)malloc( (size_t)f.n_glyphs * f.charsize);
+   assert( before);
+   memcpy( before, f.glyphs, (size_t)f.n_glyphs * f.charsize);
+   for( i = 0; i < 256; i++)
+      glyphs[i] = find_psf_or_vgafont_glyph( &f, nth_unicode_point( i));
+   saved = compact_psf_or_vgafont( &f);
+   report( "compacted_glyph_bytes", (double)f.n_glyphs * (double)f.charsize);
+   report( "compaction_saved_bytes", (double)saved);
+   for( i = 0; i < 256; i++)
+      if( glyphs[i] >= 0 && memcmp( before + glyphs[i] * f.charsize,
+             f.glyphs + find_psf_or_vgafont_glyph( &f, nth_unicode_point( i))
+                                 * f.charsize, f.charsize))
+         fprintf( stderr, "%s: MISMATCH after compaction,  U+%x\n",
+                                 font_name, (unsigned)nth_unicode_point( i));
+   free( before);
+   free_psf_or_vgafont( &f);
+}
+
+static uint8_t *read_file( const char *filename, long *len)
+{
+   FILE *ifile = fopen( filename, "rb");
+   uint8_t *buff = NULL;
+
+   if( ifile)
+      {
+      fseek( ifile, 0L, SEEK_END);
+      *len = ftell( ifile);
+      fseek( ifile, 0L, SEEK_SET);
+      buff = (uint8_t *)malloc( (size_t)*len + 1);
+      if( buff && fread( buff, *len, 1, ifile) != 1)
+         {
+         free( buff);
+         buff = NULL;
+         }
+      fclose( ifile);
+      }
+   return( buff);
+}
+
+int main( const int argc, const char **argv)
+{
+   const char *types[10];
+   int i, n_types = 0, n_files = 0;
+   long n_lookups = 1000000, n_glyphs = 65536;
+   double density = 1.;
+   char name[100];
+
+   srand( 1);
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] && i + 1 < argc)
+         {
+         const char *arg = argv[++i];
+
+         switch( argv[i - 1][1])
+            {
+            case 't':
+               if( n_types < 10)
+                  types[n_types++] = arg;
+               break;
+            case 'g':
+               n_glyphs = atol( arg);
+               break;
+            case 'd':
+               density = atof( arg);
+               break;
+            case 'n':
+               n_lookups = atol( arg);
+               break;
+            case 's':
+               srand( (unsigned)atoi( arg));
+               break;
+            default:
+               fprintf( stderr, "Option '%s' not recognized\n", argv[i - 1]);
+               return( -1);
+            }
+         }
+      else
+         n_files++;
+   if( !n_types && !n_files)
+      {
+      types[n_types++] = "psf1";
+      types[n_types++] = "psf2";
+      types[n_types++] = "vga";
+      }
+   printf( "font\tmetric\tvalue\n");
+   for( i = 0; i < n_types; i++)
+      {
+      long len;
+      uint32_t n_glyphs_made = (uint32_t)n_glyphs;
+      uint8_t *buff = make_font( types[i], &n_glyphs_made, density, &len);
+
+      if( !buff)
+         {
+         fprintf( stderr, "Font type '%s' not recognized\n", types[i]);
+         return( -1);
+         }
+      snprintf( name, sizeof( name), "%s:%u:%.2f", types[i],
+                           (unsigned)n_glyphs_made, density);
+      font_name = name;
+      bench_font( buff, len, n_lookups);
+      free( buff);
+      }
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-' && argv[i][1] && i + 1 < argc)
+         i++;
+      else
+         {
+         long len;
+         uint8_t *buff = read_file( argv[i], &len);
+
+         font_name = argv[i];
+         if( !buff)
+            fprintf( stderr, "Couldn't read '%s'\n", argv[i]);
+         else
+            bench_font( buff, len, n_lookups);
+         free( buff);
+         }
+   return( 0);
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "psf.h"
+#include "psf_cache.h"
+
+/* Drawing a glyph from a PSF (or vgafont) font means pulling out each
+pixel with a shift and mask,  and writing out the foreground or
+background colour for it.  Do that for every glyph on every frame,
+and it adds up.  This cache holds glyphs already 'expanded' to 8,  16,
+24 or 32 bits per pixel for a given pair of colours :  each row is laid
+out exactly as it'll be in the framebuffer,  so that drawing a cached
+glyph is just one memcpy() per row.
+
+   The cache is given a maximum size in bytes,  and holds as many
+glyphs as fit in that.  When it's full,  the least-recently-used glyph
+is thrown out.  The glyphs are found with a small hash table (glyph
+number -> slot),  and the slots are kept in a doubly-linked list in
+order of use.  Different colours need a different cache.   */
+
+#define NO_SLOT      0xffffffff
+
+struct cache_slot {
+   int32_t glyph_num;
+   uint32_t prev, next;       /* LRU list;  'prev' is more recently used */
+   uint32_t hash_next;        /* next slot in this hash bucket */
+};
+
+struct glyph_cache {
+   const struct font_info *font;
+   int bytes_per_pixel;
+   uint8_t fg[4], bg[4];
+   size_t row_bytes, glyph_bytes;
+   uint32_t n_slots, n_used, hash_mask;
+   uint32_t lru_head, lru_tail;
+   struct cache_slot *slots;
+   uint32_t *buckets;
+   uint8_t *pixels;
+   unsigned long n_hits, n_misses;
+};
+
+   /* Stores one pixel value as the framebuffer wants it :  in the
+   host's byte order for 16 and 32 bits,  and packed low byte first for
+   24 bits.  fbcon.c uses this too,  for underlines. */
+
+void encode_glyph_cache_pixel( uint8_t *out, const uint32_t pixel,
+                                       const int bytes_per_pixel)
+{
+   if( bytes_per_pixel == 1)
+      out[0] = (uint8_t)pixel;
+   else if( bytes_per_pixel == 2)
+      {
+      const uint16_t pixel16 = (uint16_t)pixel;
+
+      memcpy( out, &pixel16, 2);
+      }
+   else if( bytes_per_pixel == 3)
+      {
+      out[0] = (uint8_t)pixel;
+      out[1] = (uint8_t)( pixel >> 8);
+      out[2] = (uint8_t)( pixel >> 16);
+      }
+   else
+      memcpy( out, &pixel, 4);
+}
+
+struct glyph_cache *create_glyph_cache( const struct font_info *f,
+               const int bytes_per_pixel, const uint32_t fg, const uint32_t bg,
+               const size_t max_bytes)
+{
+   struct glyph_cache *cache;
+   uint32_t n_buckets = 1;
+
+   if( bytes_per_pixel < 1 || bytes_per_pixel > 4)
+      return( NULL);
+   if( !f->width || !f->height || !f->n_glyphs)    /* nothing to cache */
+      return( NULL);
+   cache = (struct glyph_cache *)calloc( 1, sizeof( struct glyph_cache));
+   if( !cache)
+      return( NULL);
+   cache->font = f;
+   cache->bytes_per_pixel = bytes_per_pixel;
+   encode_glyph_cache_pixel( cache->fg, fg, bytes_per_pixel);
+   encode_glyph_cache_pixel( cache->bg, bg, bytes_per_pixel);
+   cache->row_bytes = (size_t)f->width * bytes_per_pixel;
+   cache->glyph_bytes = cache->row_bytes * f->height;
+   cache->n_slots = (uint32_t)( max_bytes / cache->glyph_bytes);
+   if( !cache->n_slots)
+      cache->n_slots = 1;
+   if( cache->n_slots > f->n_glyphs)
+      cache->n_slots = f->n_glyphs;
+   while( n_buckets < cache->n_slots * 2)
+      n_buckets <<= 1;
+   cache->hash_mask = n_buckets - 1;
+   cache->lru_head = cache->lru_tail = NO_SLOT;
+   cache->slots = (struct cache_slot *)malloc( cache->n_slots * sizeof( struct cache_slot));
+   cache->buckets = (uint32_t *)malloc( n_buckets * sizeof( uint32_t));
+   cache->pixels = (uint8_t *)malloc( cache->n_slots * cache->glyph_bytes);
+   if( !cache->slots || !cache->buckets || !cache->pixels)
+      {
+      free_glyph_cache( cache);
+      return( NULL);
+      }
+   memset( cache->buckets, 0xff, n_buckets * sizeof( uint32_t));
+   return( cache);
+}
+
+void free_glyph_cache( struct glyph_cache *cache)
+{
+   if( cache)
+      {
+      free( cache->slots);
+      free( cache->buckets);
+      free( cache->pixels);
+      free( cache);
+      }
+}
+
+void get_glyph_cache_stats( const struct glyph_cache *cache,
+               unsigned long *n_hits, unsigned long *n_misses)
+{
+   *n_hits = cache->n_hits;
+   *n_misses = cache->n_misses;
+}
+
+static void _unlink_slot( struct glyph_cache *cache, const uint32_t idx)
+{
+   struct cache_slot *slot = cache->slots + idx;
+
+   if( slot->prev != NO_SLOT)
+      cache->slots[slot->prev].next = slot->next;
+   else
+      cache->lru_head = slot->next;
+   if( slot->next != NO_SLOT)
+      cache->slots[slot->next].prev = slot->prev;
+   else
+      cache->lru_tail = slot->prev;
+}
+
+static void _link_slot_at_head( struct glyph_cache *cache, const uint32_t idx)
+{
+   struct cache_slot *slot = cache->slots + idx;
+
+   slot->prev = NO_SLOT;
+   slot->next = cache->lru_head;
+   if( cache->lru_head != NO_SLOT)
+      cache->slots[cache->lru_head].prev = idx;
+   else
+      cache->lru_tail = idx;
+   cache->lru_head = idx;
+}
+
+static void _remove_from_bucket( struct glyph_cache *cache, const uint32_t idx)
+{
+   uint32_t *tptr = cache->buckets
+               + ((uint32_t)cache->slots[idx].glyph_num & cache->hash_mask);
+
+   while( *tptr != idx)
+      tptr = &cache->slots[*tptr].hash_next;
+   *tptr = cache->slots[idx].hash_next;
+}
+
+static void _expand_glyph( const struct glyph_cache *cache, const int glyph_num,
+                        uint8_t *dest)
+{
+   const struct font_info *f = cache->font;
+   const uint32_t stride = (f->width + 7) / 8;
+   const uint8_t *src = f->glyphs + (size_t)glyph_num * f->charsize;
+   const int bpp = cache->bytes_per_pixel;
+   uint32_t x, y;
+
+   for( y = 0; y < f->height; y++, src += stride)
+      for( x = 0; x < f->width; x++, dest += bpp)
+         memcpy( dest, ((src[x >> 3] << (x & 7)) & 0x80) ? cache->fg : cache->bg,
+                     bpp);
+}
+
+/* Returns a pointer to the expanded glyph :  'height' rows,  each
+'width * bytes_per_pixel' bytes long,  with no padding between rows.
+The pointer is good until the next call for a different glyph evicts
+it.  NULL is returned for glyph numbers not in the font. */
+
+const uint8_t *get_cached_glyph( struct glyph_cache *cache, const int glyph_num)
+{
+   uint32_t idx, *bucket;
+
+   if( glyph_num < 0 || (uint32_t)glyph_num >= cache->font->n_glyphs)
+      return( NULL);
+   bucket = cache->buckets + ((uint32_t)glyph_num & cache->hash_mask);
+   for( idx = *bucket; idx != NO_SLOT; idx = cache->slots[idx].hash_next)
+      if( cache->slots[idx].glyph_num == glyph_num)
+         {
+         cache->n_hits++;
+         if( idx != cache->lru_head)
+            {
+            _unlink_slot( cache, idx);
+            _link_slot_at_head( cache, idx);
+            }
+         return( cache->pixels + idx * cache->glyph_bytes);
+         }
+   cache->n_misses++;
+   if( cache->n_used < cache->n_slots)
+      idx = cache->n_used++;
+   else
+      {                       /* evict least recently used glyph */
+      idx = cache->lru_tail;
+      _unlink_slot( cache, idx);
+      _remove_from_bucket( cache, idx);
+      }
+   cache->slots[idx].glyph_num = glyph_num;
+   cache->slots[idx].hash_next = *bucket;
+   *bucket = idx;
+   _link_slot_at_head( cache, idx);
+   _expand_glyph( cache, glyph_num, cache->pixels + idx * cache->glyph_bytes);
+   return( cache->pixels + idx * cache->glyph_bytes);
+}
+
+/* Draws a glyph with its top left corner at 'dest',  where rows are
+'dest_stride' bytes apart.  Returns -1 if the glyph isn't in the font. */
+
+int draw_cached_glyph( struct glyph_cache *cache, const int glyph_num,
+               uint8_t *dest, const size_t dest_stride)
+{
+   const uint8_t *src = get_cached_glyph( cache, glyph_num);
+   uint32_t y;
+
+   if( !src)
+      return( -1);
+   for( y = 0; y < cache->font->height; y++)
+      {
+      memcpy( dest, src, cache->row_bytes);
+      dest += dest_stride;
+      src += cache->row_bytes;
+      }
+   return( 0);
+}
@@ -0,0 +1,15 @@
+/* Cache of glyphs 'expanded' to framebuffer pixels;  see psf_cache.c */
+
+struct glyph_cache;
+
+struct glyph_cache *create_glyph_cache( const struct font_info *f,
+               const int bytes_per_pixel, const uint32_t fg, const uint32_t bg,
+               const size_t max_bytes);
+const uint8_t *get_cached_glyph( struct glyph_cache *cache, const int glyph_num);
+int draw_cached_glyph( struct glyph_cache *cache, const int glyph_num,
+               uint8_t *dest, const size_t dest_stride);
+void get_glyph_cache_stats( const struct glyph_cache *cache,
+               unsigned long *n_hits, unsigned long *n_misses);
+void free_glyph_cache( struct glyph_cache *cache);
+void encode_glyph_cache_pixel( uint8_t *out, const uint32_t pixel,
+                                       const int bytes_per_pixel);
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifndef _WIN32
+   #include <unistd.h>
+   #include <sys/stat.h>
+#endif
+#include "psf.h"
+#include "psf_gz.h"
+
+/* Console fonts,  as shipped with most Linux distributions,  are
+gzipped ('.psf.gz' or '.psfu.gz').  open_psf_gz() opens such a font
+(or an uncompressed one;  it checks the gzip magic bytes).  Release
+the font with close_psf_or_vgafont(),  as usual.
+
+   If 'max_glyphs' is non-zero,  only the header and the first
+'max_glyphs' glyphs are decompressed;  we stop reading there.  Since
+the Unicode table comes after all the glyphs,  the font you get has
+no Unicode table,  so glyph numbers are used as code points.  That's
+fine for,  say,  a clock that only needs ASCII digits,  and is much
+faster than decompressing a big font.  (PSF1 fonts come in 256 or 512
+glyphs,  so for those,  max_glyphs is rounded up to one or the other.)
+
+   If 'max_glyphs' is zero,  the whole font is decompressed and written
+to a cache directory :  $PSF_FONT_CACHE,  $XDG_CACHE_HOME/psf-fonts,
+or $HOME/.cache/psf-fonts.  The cached file is named for a hash of the
+compressed file's device,  inode,  modification time and size,  so a
+changed font gets a new cache file,  and the same font reached through
+different paths (symlinks,  say) shares one.  Later opens just memory-map the
+cached copy with open_psf_or_vgafont(),  which in turn means the
+Unicode index can come from its cache.  If there's no usable cache
+directory (or we're on Windows),  the font is decompressed into
+memory every time. */
+
+static uint32_t get32( const uint8_t *bytes)
+{
+   return( (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8)
+            | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+}
+
+static void put32( uint8_t *bytes, const uint32_t value)
+{
+   bytes[0] = (uint8_t)value;
+   bytes[1] = (uint8_t)( value >> 8);
+   bytes[2] = (uint8_t)( value >> 16);
+   bytes[3] = (uint8_t)( value >> 24);
+}
+
+static int _load_from_buffer( struct font_info *f, uint8_t *buff, const long len)
+{
+   if( load_psf_or_vgafont( f, buff, len))
+      {
+      free( buff);
+      return( -1);
+      }
+   f->owned_glyphs = buff;        /* so it's freed with the font */
+   return( 0);
+}
+
+/* Reads the header and the first 'max_glyphs' glyphs,  then patches the
+header to say that's all there is (and that there's no Unicode table).
+The sizes come straight from the (possibly damaged) header,  so they're
+checked before we allocate anything :  a partial load is meant to be
+small,  and one wanting more than MAX_PARTIAL_BYTES is refused. */
+
+#define MAX_PARTIAL_BYTES     (1 << 24)
+
+static int _load_partial( struct font_info *f, gzFile ifile, uint32_t max_glyphs)
+{
+   uint8_t hdr[32], *buff;
+   uint32_t headersize, n_glyphs, charsize;
+   size_t glyph_bytes;
+
+   if( gzread( ifile, hdr, 4) != 4)
+      return( -1);
+   if( hdr[0] == PSF1_MAGIC0 && hdr[1] == PSF1_MAGIC1)
+      {
+      headersize = 4;
+      charsize = hdr[3];
+      n_glyphs = ((hdr[2] & PSF1_MODE512) ? 512 : 256);
+      if( max_glyphs > 256)
+         max_glyphs = 512;
+      else
+         {
+         max_glyphs = 256;
+         hdr[2] &= ~PSF1_MODE512;
+         }
+      hdr[2] &= ~(PSF1_MODEHASTAB | PSF1_MODEHASSEQ);
+      }
+   else if( hdr[0] == PSF2_MAGIC0 && hdr[1] == PSF2_MAGIC1
+               && hdr[2] == PSF2_MAGIC2 && hdr[3] == PSF2_MAGIC3)
+      {
+      if( gzread( ifile, hdr + 4, 28) != 28)
+         return( -1);
+      headersize = get32( hdr + 8);
+      n_glyphs = get32( hdr + 16);
+      charsize = get32( hdr + 20);
+      if( headersize < 32)
+         return( -1);
+      put32( hdr + 12, get32( hdr + 12) & ~PSF2_HAS_UNICODE_TABLE);
+      }
+   else        /* vgafonts have to be read in full */
+      return( -2);
+   if( max_glyphs > n_glyphs)
+      max_glyphs = n_glyphs;
+   if( !charsize || !max_glyphs || headersize > MAX_PARTIAL_BYTES
+            || (uint64_t)max_glyphs * charsize > MAX_PARTIAL_BYTES - headersize)
+      return( -1);
+   glyph_bytes = (size_t)max_glyphs * charsize;
+   buff = (uint8_t *)malloc( headersize + glyph_bytes);
+   if( !buff)
+      return( -1);
+   memcpy( buff, hdr, (headersize < 32 ? headersize : 32));
+   if( headersize > 32)          /* rest of an unusually long header */
+      if( gzread( ifile, buff + 32, headersize - 32) != (int)( headersize - 32))
+         {
+         free( buff);
+         return( -1);
+         }
+   if( gzread( ifile, buff + headersize, (unsigned)glyph_bytes) != (int)glyph_bytes)
+      {
+      free( buff);
+      return( -1);
+      }
+   if( headersize >= 32)        /* PSF2 */
+      put32( buff + 16, max_glyphs);
+   return( _load_from_buffer( f, buff, (long)( headersize + glyph_bytes)));
+}
+
+static uint8_t *_read_all( gzFile ifile, long *len)
+{
+   size_t size = 0, alloced = 65536;
+   uint8_t *buff = (uint8_t *)malloc( alloced);
+   int n_read;
+
+   while( buff && (n_read = gzread( ifile, buff + size,
+                                    (unsigned)( alloced - size))) > 0)
+      {
+      size += (size_t)n_read;
+      if( size == alloced)
+         {
+         uint8_t *new_buff = (uint8_t *)realloc( buff, alloced * 2);
+
+         if( !new_buff)
+            free( buff);
+         buff = new_buff;
+         alloced *= 2;
+         }
+      }
+   if( buff && n_read < 0)
+      {
+      free( buff);
+      buff = NULL;
+      }
+   *len = (long)size;
+   return( buff);
+}
+
+#ifndef _WIN32
+static int _decompress_to_file( gzFile ifile, const char *filename)
+{
+   char temp_name[320];
+   uint8_t buff[65536];
+   FILE *ofile;
+   int n_read, okay = 1, fd;
+
+            /* mkstemp(),  so that other threads or processes decompressing
+            the same font at the same time don't share our temporary file */
+   snprintf( temp_name, sizeof( temp_name), "%s.XXXXXX", filename);
+   fd = mkstemp( temp_name);
+   if( fd < 0)
+      return( -1);
+   ofile = fdopen( fd, "wb");
+   if( !ofile)
+      {
+      close( fd);
+      unlink( temp_name);
+      return( -1);
+      }
+   while( okay && (n_read = gzread( ifile, buff, sizeof( buff))) > 0)
+      okay = (fwrite( buff, n_read, 1, ofile) == 1);
+   if( n_read < 0)
+      okay = 0;
+   if( fclose( ofile) || !okay || rename( temp_name, filename))
+      {
+      unlink( temp_name);
+      return( -1);
+      }
+   return( 0);
+}
+#endif
+
+int open_psf_gz( struct font_info *f, const char *filename,
+                                    const uint32_t max_glyphs)
+{
+   FILE *test = fopen( filename, "rb");
+   uint8_t magic[2], *buff;
+   gzFile ifile;
+   long len;
+   int rval;
+
+   if( !test)
+      return( -1);
+   rval = (int)fread( magic, 1, 2, test);
+   fclose( test);
+   if( rval != 2 || magic[0] != 0x1f || magic[1] != 0x8b)
+      return( open_psf_or_vgafont( f, filename));
+#ifndef _WIN32
+   if( !max_glyphs)
+      {
+      struct stat st;
+      char cache_name[300];
+
+      if( !stat( filename, &st))
+         {
+         uint64_t key[4];
+
+         key[0] = (uint64_t)st.st_dev;
+         key[1] = (uint64_t)st.st_ino;
+         key[2] = (uint64_t)st.st_mtime;
+         key[3] = (uint64_t)st.st_size;
+         if( !psf_cache_filename( cache_name, sizeof( cache_name),
+                  "PSF_FONT_CACHE", "/psf-fonts",
+                  psf_hash( key, sizeof( key)), "psf"))
+            {
+            if( !open_psf_or_vgafont( f, cache_name))
+               return( 0);
+            ifile = gzopen( filename, "rb");
+            if( !ifile)
+               return( -1);
+            rval = _decompress_to_file( ifile, cache_name);
+            gzclose( ifile);
+            if( !rval && !open_psf_or_vgafont( f, cache_name))
+               return( 0);
+            }
+         }
+      }
+#endif
+   ifile = gzopen( filename, "rb");
+   if( !ifile)
+      return( -1);
+   rval = (max_glyphs ? _load_partial( f, ifile, max_glyphs) : -2);
+   if( rval == -2)      /* read it all */
+      {
+      gzrewind( ifile);
+      buff = _read_all( ifile, &len);
+      rval = (buff ? _load_from_buffer( f, buff, len) : -1);
+      }
+   gzclose( ifile);
+   return( rval);
+}
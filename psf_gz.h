@@ -0,0 +1,4 @@
+/* Opening gzipped PSF fonts;  see psf_gz.c */
+
+int open_psf_gz( struct font_info *f, const char *filename,
+                                    const uint32_t max_glyphs);
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "psf.h"
+#include "psf_registry.h"
+
+/* If several threads (or several parts of one program) each open
+the same font,  each gets its own parsed Unicode index,  and nobody
+knows when the font can be closed.  Instead,  call acquire_font() to
+get a shared,  read-only font,  and release_font() when done with it.
+The first acquire_font() for a given font opens it,  just as
+open_psf_or_vgafont() would;  later ones return the same font_info
+and bump a reference count.  When the last user releases it,  the font
+is closed.  All of this is protected by a mutex,  so any thread can
+acquire or release fonts at any time.  The font_info returned is never
+modified while anyone holds it,  so lookups need no locking at all.
+
+   Fonts are found first by path.  We remember the device,  inode,
+size and modification time of each path we've opened,  so that if the
+file has been replaced since,  we don't hand out the old version.  If
+the path is new to us,  the font is opened and its contents hashed;
+if that matches a font we already have (the same font under another
+name,  or a symlink),  and the bytes really are the same,  the new copy
+is closed and the existing one shared.  Either way,  the path is
+remembered for next time,  replacing anything we knew about it before
+(whoever still holds the old version keeps it until they release it). */
+
+struct registry_entry {
+   struct font_info font;
+   uint64_t hash;
+   size_t len;
+   int ref_count;
+   struct registry_entry *next;
+};
+
+struct registry_path {
+   char *path;
+   struct stat st;
+   struct registry_entry *entry;
+   struct registry_path *next;
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct registry_entry *entries = NULL;
+static struct registry_path *paths = NULL;
+
+static int _same_file( const struct stat *a, const struct stat *b)
+{
+   return( a->st_dev == b->st_dev && a->st_ino == b->st_ino
+            && a->st_size == b->st_size && a->st_mtime == b->st_mtime);
+}
+
+static void _remove_paths_for( const struct registry_entry *entry)
+{
+   struct registry_path **pptr = &paths;
+
+   while( *pptr)
+      if( (*pptr)->entry == entry)
+         {
+         struct registry_path *tptr = *pptr;
+
+         *pptr = tptr->next;
+         free( tptr->path);
+         free( tptr);
+         }
+      else
+         pptr = &(*pptr)->next;
+}
+
+   /* Forgets what we knew about 'path' :  called when the file has been
+   replaced since we opened it,  before remembering the new version. */
+
+static void _remove_path( const char *path)
+{
+   struct registry_path **pptr = &paths;
+
+   while( *pptr)
+      if( !strcmp( (*pptr)->path, path))
+         {
+         struct registry_path *tptr = *pptr;
+
+         *pptr = tptr->next;
+         free( tptr->path);
+         free( tptr);
+         }
+      else
+         pptr = &(*pptr)->next;
+}
+
+static const struct font_info *_acquire_font( const char *path)
+{
+   struct registry_path *pptr;
+   struct registry_entry *entry;
+   struct stat st;
+   struct font_info font;
+   uint64_t hash;
+
+   if( stat( path, &st))
+      return( NULL);
+   for( pptr = paths; pptr; pptr = pptr->next)
+      if( !strcmp( pptr->path, path) && _same_file( &pptr->st, &st))
+         {
+         pptr->entry->ref_count++;
+         return( &pptr->entry->font);
+         }
+   if( open_psf_or_vgafont( &font, path))
+      return( NULL);
+   hash = psf_hash( font.mapping, font.mapping_len);
+   for( entry = entries; entry; entry = entry->next)
+      if( entry->hash == hash && entry->len == font.mapping_len
+               && !memcmp( entry->font.mapping, font.mapping, font.mapping_len))
+         break;
+   if( entry)        /* same font as one we've already got */
+      close_psf_or_vgafont( &font);
+   else
+      {
+      entry = (struct registry_entry *)malloc( sizeof( struct registry_entry));
+      if( !entry)
+         {
+         close_psf_or_vgafont( &font);
+         return( NULL);
+         }
+      entry->font = font;
+      entry->hash = hash;
+      entry->len = font.mapping_len;
+      entry->ref_count = 0;
+      entry->next = entries;
+      entries = entry;
+      }
+   _remove_path( path);
+   pptr = (struct registry_path *)malloc( sizeof( struct registry_path));
+   if( pptr)
+      {
+      pptr->path = (char *)malloc( strlen( path) + 1);
+      if( pptr->path)
+         {
+         strcpy( pptr->path, path);
+         pptr->st = st;
+         pptr->entry = entry;
+         pptr->next = paths;
+         paths = pptr;
+         }
+      else
+         free( pptr);
+      }
+   entry->ref_count++;
+   return( &entry->font);
+}
+
+/* Returns a shared font,  or NULL if it couldn't be opened or isn't
+a PSF1/PSF2/vgafont font.  Every non-NULL return must eventually be
+passed to release_font(). */
+
+const struct font_info *acquire_font( const char *path)
+{
+   const struct font_info *rval;
+
+   pthread_mutex_lock( &registry_mutex);
+   rval = _acquire_font( path);
+   pthread_mutex_unlock( &registry_mutex);
+   return( rval);
+}
+
+void release_font( const struct font_info *f)
+{
+   struct registry_entry **eptr;
+
+   pthread_mutex_lock( &registry_mutex);
+   for( eptr = &entries; *eptr && &(*eptr)->font != f; eptr = &(*eptr)->next)
+      ;
+   assert( *eptr);         /* releasing a font we never handed out */
+   if( *eptr && !--(*eptr)->ref_count)
+      {
+      struct registry_entry *entry = *eptr;
+
+      *eptr = entry->next;
+      _remove_paths_for( entry);
+      close_psf_or_vgafont( &entry->font);
+      free( entry);
+      }
+   pthread_mutex_unlock( &registry_mutex);
+}
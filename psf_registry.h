@@ -0,0 +1,4 @@
+/* Shared,  reference-counted fonts;  see psf_registry.c */
+
+const struct font_info *acquire_font( const char *path);
+void release_font( const struct font_info *f);
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "psf.h"
+
+/* Makes a PSF2 font containing only the glyphs you actually need.  Run as
+
+./psfsubset (input font) (output font) (options)
+
+   The input can be PSF1,  PSF2 or a vgafont.  Options are :
+
+   -c filename  Keep glyphs for all text in this (UTF-8) file,  including
+                any multi-point sequences (base character plus combining
+                accents,  say) that the font has a glyph for.  Can be
+                given more than once.
+   -r ranges    Keep glyphs for these hex code points or ranges,  such as
+                -r 20-7e,a0-ff,2500-257f.  Can be given more than once.
+
+   Glyph 0 is always kept,  since by convention it's the one shown for
+missing characters;  so is the glyph for U+FFFD,  if there is one.
+The output's Unicode table is rebuilt to cover just the glyphs kept.
+Embedded displays that only ever show a script or two can thus load
+a font of a few KBytes instead of (say) all of Unifont.  */
+
+static void mark_point( const struct font_info *f, char *keep,
+                                 const uint32_t unicode_point)
+{
+   const int glyph = find_psf_or_vgafont_glyph( f, unicode_point);
+
+   if( glyph >= 0 && glyph < (int)f->n_glyphs)
+      keep[glyph] = 1;
+}
+
+static int mark_ranges( const struct font_info *f, char *keep, const char *ranges)
+{
+   while( *ranges)
+      {
+      unsigned start, end;
+      int n_bytes;
+
+      if( sscanf( ranges, "%x%n", &start, &n_bytes) != 1)
+         return( -1);
+      ranges += n_bytes;
+      end = start;
+      if( *ranges == '-')
+         {
+         if( sscanf( ranges + 1, "%x%n", &end, &n_bytes) != 1 || end < start)
+            return( -1);
+         ranges += n_bytes + 1;
+         }
+      if( end > 0x10ffff)
+         end = 0x10ffff;
+      while( start <= end)
+         mark_point( f, keep, (uint32_t)start++);
+      if( *ranges == ',')
+         ranges++;
+      else if( *ranges)
+         return( -1);
+      }
+   return( 0);
+}
+
+   /* Invalid UTF-8 is skipped a byte at a time.   */
+
+static size_t utf8_to_utf32( const uint8_t *text, const size_t len, uint32_t *obuff)
+{
+   size_t i = 0, rval = 0;
+
+   while( i < len)
+      {
+      size_t n_bytes = 1, j;
+      uint32_t cval = text[i];
+
+      if( cval >= 0xf0 && cval < 0xf5)
+         {
+         n_bytes = 4;
+         cval &= 0x07;
+         }
+      else if( cval >= 0xe0 && cval < 0xf0)
+         {
+         n_bytes = 3;
+         cval &= 0x0f;
+         }
+      else if( cval >= 0xc2 && cval < 0xe0)
+         {
+         n_bytes = 2;
+         cval &= 0x1f;
+         }
+      else if( cval >= 0x80)
+         n_bytes = 0;
+      for( j = 1; j < n_bytes; j++)
+         if( i + j >= len || (text[i + j] & 0xc0) != 0x80)
+            n_bytes = 0;
+         else
+            cval = (cval << 6) | (text[i + j] & 0x3f);
+      if( n_bytes)
+         obuff[rval++] = cval;
+      i += (n_bytes ? n_bytes : 1);
+      }
+   return( rval);
+}
+
+static int mark_corpus( const struct font_info *f, char *keep, const char *filename)
+{
+   FILE *ifile = fopen( filename, "rb");
+   uint8_t *text;
+   uint32_t *points;
+   long len;
+   size_t i, n_points;
+
+   if( !ifile)
+      return( -1);
+   fseek( ifile, 0L, SEEK_END);
+   len = ftell( ifile);
+   fseek( ifile, 0L, SEEK_SET);
+   text = (uint8_t *)malloc( len + 1);
+   points = (uint32_t *)malloc( (len + 1) * sizeof( uint32_t));
+   if( !text || !points || fread( text, 1, len, ifile) != (size_t)len)
+      {
+      free( text);
+      free( points);
+      fclose( ifile);
+      return( -2);
+      }
+   fclose( ifile);
+   n_points = utf8_to_utf32( text, (size_t)len, points);
+   free( text);
+   for( i = 0; i < n_points; i++)
+      {
+      size_t n_used;
+      const int glyph = find_psf_or_vgafont_sequence( f, points + i,
+                                          n_points - i, &n_used);
+
+      if( glyph >= 0 && glyph < (int)f->n_glyphs)
+         keep[glyph] = 1;
+      mark_point( f, keep, points[i]);    /* in case it's used alone */
+      }
+   free( points);
+   return( 0);
+}
+
+int main( const int argc, const char **argv)
+{
+   struct font_info f;
+   char *keep;
+   FILE *ofile;
+   int i, err;
+   uint32_t n_kept = 0;
+
+   if( argc < 3)
+      {
+      fprintf( stderr, "Usage: psfsubset (input font) (output font) "
+                     "-c (corpus file) -r (hex ranges)\n");
+      return( -1);
+      }
+   if( open_psf_or_vgafont( &f, argv[1]))
+      {
+      fprintf( stderr, "'%s' is neither PSF1 or PSF2 or vgafont\n", argv[1]);
+      return( -1);
+      }
+   keep = (char *)calloc( f.n_glyphs + 1, 1);
+   if( !keep)
+      {
+      fprintf( stderr, "Out of memory\n");
+      return( -1);
+      }
+   if( f.n_glyphs)
+      keep[0] = 1;
+   mark_point( &f, keep, 0xfffd);
+   for( i = 3; i < argc; i++)
+      {
+      const char *arg = (i < argc - 1 ? argv[i + 1] : "");
+
+      err = 0;
+      if( !strcmp( argv[i], "-c"))
+         err = mark_corpus( &f, keep, arg);
+      else if( !strcmp( argv[i], "-r"))
+         err = mark_ranges( &f, keep, arg);
+      else
+         {
+         fprintf( stderr, "Option '%s' not recognized\n", argv[i]);
+         return( -1);
+         }
+      if( err)
+         {
+         fprintf( stderr, "Couldn't use %s '%s'\n", argv[i], arg);
+         return( -1);
+         }
+      i++;
+      }
+   for( i = 0; i < (int)f.n_glyphs; i++)
+      if( keep[i])
+         n_kept++;
+   ofile = fopen( argv[2], "wb");
+   if( !ofile)
+      {
+      fprintf( stderr, "Couldn't open '%s'\n", argv[2]);
+      return( -1);
+      }
+   err = write_psf2_font( &f, ofile, keep);
+   if( fclose( ofile))
+      err = -2;
+   if( err)
+      fprintf( stderr, "Error %d writing '%s'\n", err, argv[2]);
+   else
+      printf( "%u of %u glyphs kept (%u bytes of bitmaps)\n",
+               n_kept, f.n_glyphs, n_kept * f.charsize);
+   free( keep);
+   close_psf_or_vgafont( &f);
+   return( err);
+}